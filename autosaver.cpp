@@ -0,0 +1,66 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "autosaver.h"
+
+#include <iostream>
+
+AutoSaver::AutoSaver(std::string path)
+  : path_(std::move(path))
+  , havePending_(false)
+  , quit_(false)
+  , thread_([this]{ run(); })
+{
+}
+
+AutoSaver::~AutoSaver()
+{
+  {
+    std::lock_guard<std::mutex> lock(guard_);
+    quit_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void AutoSaver::save(std::vector<LeverRecord> levers)
+{
+  {
+    std::lock_guard<std::mutex> lock(guard_);
+    pending_.swap(levers);
+    havePending_ = true;
+  }
+  cv_.notify_one();
+  // the previous snapshot, if it was never written, is freed here rather
+  // than under the lock
+}
+
+void AutoSaver::run()
+{
+  std::unique_lock<std::mutex> lock(guard_);
+  for(;;)
+  {
+    cv_.wait(lock, [this]{ return havePending_ || quit_; });
+    if( havePending_ )
+    {
+      std::vector<LeverRecord> levers;
+      levers.swap(pending_);
+      havePending_ = false;
+
+      lock.unlock();
+      try
+      {
+        framefile::save(path_, levers);
+      }
+      catch(std::exception const& e)
+      {
+        std::cerr << "Failed to save frame: " << e.what() << std::endl;
+      }
+      lock.lock();
+    }
+    else if( quit_ )
+    {
+      return;
+    }
+  }
+}
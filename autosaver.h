@@ -0,0 +1,38 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined AUTOSAVER_H
+#define AUTOSAVER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framefile.h"
+
+// Writes frame files on a background thread. If a new snapshot arrives
+// before the previous one has been written only the latest is saved.
+class AutoSaver
+{
+public:
+  AutoSaver(std::string path);
+  // writes any snapshot still pending
+  ~AutoSaver();
+
+  void save(std::vector<LeverRecord> levers);
+
+private:
+  void run();
+
+  std::string path_;
+  std::mutex guard_;
+  std::condition_variable cv_;
+  std::vector<LeverRecord> pending_;
+  bool havePending_;
+  bool quit_;
+  std::thread thread_;
+};
+
+#endif // !defined AUTOSAVER_H
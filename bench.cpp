@@ -0,0 +1,342 @@
+// Benchmarks for rpi-servoset, one JSON object per line on stdout
+//
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "fieldeditor.h"
+#include "framecache.h"
+#include "framefile.h"
+#include "protocol.h"
+#include "servo4.h"
+#include "tokeniser.h"
+
+namespace
+{
+  // prefixes of the benchmarks to run given on the command line, all of
+  // them if empty
+  std::vector<std::string> selected;
+
+  bool isSelected(std::string const& name)
+  {
+    if( selected.empty() )
+    {
+      return true;
+    }
+    for( auto&& prefix : selected )
+    {
+      if( name.compare(0, prefix.size(), prefix) == 0 )
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Runs fn until at least minTime has passed and reports the mean time
+  // per call
+  template<typename Fn>
+  void run(std::string const& name, std::size_t size, Fn fn)
+  {
+    if( !isSelected(name) )
+    {
+      return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto const minTime = std::chrono::milliseconds(500);
+
+    fn(); // warm up
+    unsigned long iterations = 0;
+    auto start = Clock::now();
+    auto elapsed = Clock::duration();
+    do
+    {
+      fn();
+      iterations++;
+      elapsed = Clock::now() - start;
+    }
+    while( elapsed < minTime );
+
+    std::cout << "{\"benchmark\":\"" << name << "\""
+              << ",\"size\":" << size
+              << ",\"iterations\":" << iterations
+              << ",\"ns_per_op\":"
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / iterations
+              << "}" << std::endl;
+  }
+
+  std::string generateFrame(std::size_t levers)
+  {
+    static char const types[] = "SPF-";
+    std::ostringstream os;
+    os << "# Name,Board,servo,Type(S|P|F|-),Normal-pos,Reversed-pos,Pull-speed,"
+       << "Return-speed,Description\n";
+    for( std::size_t i = 0; i < levers; i++ )
+    {
+      framefile::write(
+        os,
+        LeverRecord{
+          std::to_string(i + 1),
+          static_cast<int>(i / 4),
+          static_cast<int>(i % 4),
+          types[i % 4],
+          static_cast<int>(i % 256),
+          static_cast<int>((i * 7) % 256),
+          static_cast<int>(i % 7),
+          static_cast<int>((i + 3) % 7),
+          "Lever " + std::to_string(i + 1) + ", generated"});
+    }
+    return os.str();
+  }
+
+  std::string benchPath()
+  {
+    return "/tmp/servoset-bench-" + std::to_string(getpid()) + ".frame";
+  }
+
+  void benchTokeniser(std::size_t levers)
+  {
+    auto text = generateFrame(levers);
+    run("tokeniser_next", levers, [&text]()
+    {
+      std::size_t fields = 0;
+      std::string_view rest(text);
+      while( !rest.empty() )
+      {
+        auto eol = rest.find('\n');
+        Tokeniser tokens(rest.substr(0, eol));
+        while( tokens.next().first )
+        {
+          fields++;
+        }
+        rest.remove_prefix(eol == std::string_view::npos ? rest.size() : eol + 1);
+      }
+      if( fields == 0 )
+      {
+        throw std::runtime_error("no fields tokenised");
+      }
+    });
+  }
+
+  void benchFrameParse(std::size_t levers)
+  {
+    auto text = generateFrame(levers);
+    run("frame_parse", levers, [&text, levers]()
+    {
+      if( framefile::parse(text, {}).size() != levers )
+      {
+        throw std::runtime_error("wrong number of levers parsed");
+      }
+    });
+  }
+
+  void benchFrameWrite(std::size_t levers)
+  {
+    auto records = framefile::parse(generateFrame(levers), {});
+    run("record_write", levers, [&records]()
+    {
+      std::ostringstream os;
+      for( auto&& record : records )
+      {
+        framefile::write(os, record);
+      }
+    });
+
+    auto path = benchPath();
+    run("frame_save", levers, [&path, &records]()
+    {
+      framefile::save(path, records);
+    });
+    std::remove(path.c_str());
+  }
+
+  void benchFrameLoad(std::size_t levers)
+  {
+    auto path = benchPath();
+    {
+      std::ofstream os(path);
+      os << generateFrame(levers);
+    }
+
+    run("frame_load", levers, [&path]()
+    {
+      auto records = framefile::load(path, {});
+      if( records.empty() )
+      {
+        throw std::runtime_error("no levers loaded");
+      }
+    });
+
+    // the warm up writes the cache, and every lever is looked at as
+    // LeverFrame would
+    run("frame_load_cache", levers, [&path, levers]()
+    {
+      auto frame = FrameCache::load(path, {});
+      std::size_t names = 0;
+      for( std::size_t i = 0; i < frame.size(); i++ )
+      {
+        names += !frame[i].name_.empty();
+      }
+      if( names != levers )
+      {
+        throw std::runtime_error("wrong number of levers loaded from cache");
+      }
+    });
+
+    std::remove(path.c_str());
+    std::remove(FrameCache::path(path).c_str());
+  }
+
+  // Encodes every command and value the boards take and checks the
+  // decoder gets the same packets back
+  void checkServo4RoundTrip()
+  {
+    std::vector<char> stream;
+    std::vector<std::pair<unsigned int, unsigned int>> sent;
+    for( unsigned int cmd = servo4::store; cmd < servo4::command(4, 0, 0); cmd++ )
+    {
+      for( unsigned int value = 0; value <= 255; value++ )
+      {
+        auto end = stream.size();
+        stream.resize(end + protocol::servo4.packetSize_);
+        protocol::servo4.encode_(cmd, value, &stream[end]);
+        sent.emplace_back(cmd, value);
+      }
+    }
+
+    std::size_t received = 0;
+    servo4::Decoder decoder;
+    decoder.decode(
+      stream.data(),
+      stream.size(),
+      [&](unsigned int cmd, unsigned int value)
+      {
+        if( received >= sent.size() || sent[received] != std::make_pair(cmd, value) )
+        {
+          throw std::runtime_error("servo4 packet " + std::to_string(received) + " decoded wrongly");
+        }
+        received++;
+      });
+    if( received != sent.size() || decoder.errors() != 0 )
+    {
+      throw std::runtime_error("servo4 round trip lost packets");
+    }
+    std::cout << "{\"check\":\"servo4_round_trip\",\"packets\":" << received << "}" << std::endl;
+  }
+
+  void benchEncode()
+  {
+    std::size_t const packets = 1000;
+    std::vector<char> out(packets * servo4::packetSize + 1);
+    auto cmd = servo4::command(0, 0, 0);
+
+    run("servo4_encode_snprintf", packets, [&]()
+    {
+      for( std::size_t i = 0; i < packets; i++ )
+      {
+        auto p = &out[i * servo4::packetSize];
+        p[0] = 0;
+        snprintf(p + 1, 5, "%c%03d", cmd, static_cast<unsigned int>(i % 256));
+      }
+    });
+    run("servo4_encode", packets, [&]()
+    {
+      for( std::size_t i = 0; i < packets; i++ )
+      {
+        servo4::encode(cmd, i % 256, &out[i * servo4::packetSize]);
+      }
+    });
+    run("protocol_encode", packets, [&]()
+    {
+      auto& protocol = *protocol::find("servo4");
+      for( std::size_t i = 0; i < packets; i++ )
+      {
+        protocol.encode_(cmd, i % 256, &out[i * protocol.packetSize_]);
+      }
+    });
+  }
+
+  // Steps as they arrive from a held button, several per frame, turning
+  // round each time the value reaches an end of its range
+  void benchFieldEditor()
+  {
+    std::size_t const steps = 1000;
+    std::size_t const stepsPerFrame = 4;
+    unsigned long changes = 0;
+    int direction = 1;
+    FieldEditor editor(
+      128,
+      0,
+      255,
+      {},
+      [&](int value)
+      {
+        changes++;
+        if( value == 255 || value == 0 )
+        {
+          direction = -direction;
+        }
+      },
+      {});
+    editor.enter();
+
+    run("field_editor_steps", steps, [&]()
+    {
+      for( std::size_t i = 0; i < steps; i++ )
+      {
+        if( direction > 0 )
+        {
+          editor.right();
+        }
+        else
+        {
+          editor.left();
+        }
+        if( i % stepsPerFrame == 0 )
+        {
+          editor.flush();
+        }
+      }
+      editor.flush();
+    });
+    if( isSelected("field_editor_steps") && changes == 0 )
+    {
+      throw std::runtime_error("field editor never changed value");
+    }
+  }
+}
+
+// Any arguments are prefixes of the benchmark names to run
+int main(int argc, char** argv)
+{
+  selected.assign(argv + 1, argv + argc);
+
+  try
+  {
+    checkServo4RoundTrip();
+    benchEncode();
+    benchFieldEditor();
+    for( auto levers : { 100, 1000, 10000, 100000 } )
+    {
+      benchTokeniser(levers);
+      benchFrameParse(levers);
+      benchFrameWrite(levers);
+      benchFrameLoad(levers);
+    }
+  }
+  catch(std::exception const& e)
+  {
+    std::cerr << "An exception occurred: " << e.what() << std::endl;
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,424 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "controlserver.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <iterator>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "tokeniser.h"
+
+namespace
+{
+  // lines a client may run before the next client gets a turn
+  int const commandsPerTurn = 4;
+  // unread input beyond this is left in the socket until the client's
+  // earlier commands have run
+  std::size_t const maxInput = 4096;
+  std::size_t const maxClients = 16;
+  // how often a held client's link is looked at again, a few packets'
+  // time at the slowest baud rate
+  int const heldRetryMs = 20;
+
+  struct Setting
+  {
+    char const* name_;
+    ServoController::Direction direction_;
+    ServoController::Function function_;
+    int max_;
+  };
+
+  Setting const settings[] =
+  {
+    { "normal", ServoController::Normal, ServoController::Position, 255 },
+    { "reversed", ServoController::Reversed, ServoController::Position, 255 },
+    { "pull", ServoController::Normal, ServoController::Speed, 6 },
+    { "return", ServoController::Reversed, ServoController::Speed, 6 }
+  };
+
+  bool to_value(std::string_view str, int max, unsigned int& value)
+  {
+    auto end = str.data() + str.size();
+    auto result = std::from_chars(str.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end && value <= static_cast<unsigned int>(max);
+  }
+}
+
+ControlServer::ControlServer(
+  std::string const& path,
+  FrameCache const& frame,
+  ServoController& servoController)
+  : path_(path)
+  , servoController_(servoController)
+  , listenFd_(-1)
+  , wakeFd_(-1)
+  , nextSession_(1)
+{
+  for( std::size_t i = 0; i < frame.size(); i++ )
+  {
+    auto lever = frame[i];
+    if( lever.type_ != '-' )
+    {
+      servos_[std::string(lever.name_)] = Servo{lever.board_, lever.connector_};
+    }
+  }
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if( path.size() >= sizeof(addr.sun_path) )
+  {
+    throw std::runtime_error("Control socket path too long: " + path);
+  }
+  std::strcpy(addr.sun_path, path.c_str());
+
+  // a socket left behind by an earlier run would stop bind working, but
+  // anything else at path is left alone in case the path was mistyped
+  struct stat st;
+  if( lstat(path.c_str(), &st) == 0 )
+  {
+    if( !S_ISSOCK(st.st_mode) )
+    {
+      throw std::runtime_error(path + ": exists and is not a socket");
+    }
+    unlink(path.c_str());
+  }
+  listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if( listenFd_ < 0 ||
+      bind(listenFd_, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) < 0 ||
+      listen(listenFd_, 8) < 0 )
+  {
+    auto error = path + ": " + std::strerror(errno);
+    if( listenFd_ >= 0 )
+    {
+      close(listenFd_);
+    }
+    throw std::runtime_error(error);
+  }
+
+  wakeFd_ = eventfd(0, EFD_NONBLOCK);
+  if( wakeFd_ < 0 )
+  {
+    close(listenFd_);
+    throw std::runtime_error(std::strerror(errno));
+  }
+  thread_ = std::thread([this]{ run(); });
+}
+
+ControlServer::~ControlServer()
+{
+  // the event loop can't be stopped any other way, so don't give up
+  // unless the eventfd itself is broken
+  uint64_t one = 1;
+  while( write(wakeFd_, &one, sizeof(one)) < 0 && errno != EAGAIN )
+  {
+    if( errno != EINTR )
+    {
+      std::cerr << "Failed to stop control server: " << std::strerror(errno) << std::endl;
+      std::terminate();
+    }
+  }
+  thread_.join();
+  close(wakeFd_);
+  close(listenFd_);
+  unlink(path_.c_str());
+}
+
+void ControlServer::run()
+{
+  std::vector<pollfd> fds;
+  std::size_t turn = 0;
+  bool more = false;
+  bool held = false;
+  for(;;)
+  {
+    fds.clear();
+    fds.push_back({ wakeFd_, POLLIN, 0 });
+    fds.push_back({ listenFd_, POLLIN, 0 });
+    for( auto&& client : clients_ )
+    {
+      short events = client.out_.empty() ? 0 : POLLOUT;
+      if( !client.hungUp_ && !client.held_ && client.in_.size() < maxInput )
+      {
+        events |= POLLIN;
+      }
+      fds.push_back({ client.fd_, events, 0 });
+    }
+
+    // don't sleep while clients still have commands waiting their turn,
+    // and only briefly while any are held
+    if( poll(fds.data(), fds.size(), more ? 0 : held ? heldRetryMs : -1) < 0 && errno != EINTR )
+    {
+      std::cerr << "Control server poll failed: " << std::strerror(errno) << std::endl;
+      break;
+    }
+    if( (fds[0].revents & POLLIN) != 0 )
+    {
+      break;
+    }
+
+    for( std::size_t i = 0; i < clients_.size(); i++ )
+    {
+      auto& client = clients_[i];
+      auto revents = fds[i + 2].revents;
+      if( ((revents & (POLLIN | POLLHUP | POLLERR)) != 0 && !receive(client)) ||
+          ((revents & POLLOUT) != 0 && !send(client)) )
+      {
+        disconnect(client);
+      }
+    }
+
+    // clients take turns at running a few commands each, starting with a
+    // different client every time round
+    more = false;
+    held = false;
+    for( std::size_t i = 0; i < clients_.size(); i++ )
+    {
+      auto& client = clients_[(turn + i) % clients_.size()];
+      if( client.fd_ >= 0 )
+      {
+        more = execute(client) || more;
+        held = client.held_ || held;
+        if( !send(client) )
+        {
+          disconnect(client);
+        }
+      }
+    }
+    turn++;
+
+    clients_.erase(
+      std::remove_if(
+        clients_.begin(),
+        clients_.end(),
+        [](Client const& client){ return client.fd_ < 0; }),
+      clients_.end());
+
+    if( (fds[1].revents & POLLIN) != 0 )
+    {
+      accept();
+    }
+  }
+
+  for( auto&& client : clients_ )
+  {
+    disconnect(client);
+  }
+  clients_.clear();
+}
+
+void ControlServer::accept()
+{
+  int fd;
+  while( (fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 )
+  {
+    if( clients_.size() >= maxClients )
+    {
+      close(fd);
+      continue;
+    }
+    clients_.push_back(Client{fd, nextSession_++, false, false, false, 0, 0, {}, {}});
+  }
+}
+
+bool ControlServer::receive(Client& client)
+{
+  char buf[1024];
+  auto n = read(client.fd_, buf, std::min(sizeof(buf), maxInput - client.in_.size()));
+  if( n > 0 )
+  {
+    client.in_.append(buf, n);
+    return true;
+  }
+  if( n == 0 )
+  {
+    // run whatever the client sent before it hung up
+    client.hungUp_ = true;
+    return client.in_.find('\n') != std::string::npos;
+  }
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+bool ControlServer::send(Client& client)
+{
+  while( !client.out_.empty() )
+  {
+    auto n = ::send(client.fd_, client.out_.data(), client.out_.size(), MSG_NOSIGNAL);
+    if( n >= 0 )
+    {
+      client.out_.erase(0, n);
+    }
+    else if( errno == EAGAIN || errno == EWOULDBLOCK )
+    {
+      return true;
+    }
+    else if( errno != EINTR )
+    {
+      return false;
+    }
+  }
+  return !client.hungUp_ || client.in_.find('\n') != std::string::npos;
+}
+
+bool ControlServer::execute(Client& client)
+{
+  for( int i = 0; i < commandsPerTurn; i++ )
+  {
+    auto end = client.in_.find('\n');
+    if( end == std::string::npos )
+    {
+      if( client.in_.size() >= maxInput )
+      {
+        client.out_ += "error,line too long\n";
+        client.in_.clear();
+      }
+      return false;
+    }
+    std::string_view line(client.in_.data(), end);
+    if( !line.empty() && line.back() == '\r' )
+    {
+      line.remove_suffix(1);
+    }
+    auto to = board(client, line);
+    client.held_ = to >= 0 && servoController_.backedUp(client.session_, to);
+    if( client.held_ )
+    {
+      return false;
+    }
+    client.out_ += command(client, line);
+    client.out_ += '\n';
+    client.in_.erase(0, end + 1);
+  }
+  return client.in_.find('\n') != std::string::npos;
+}
+
+int ControlServer::board(Client const& client, std::string_view line) const
+{
+  Tokeniser tokens(line);
+  auto verb = tokens.next().second;
+  if( verb == "update" || verb == "finish" )
+  {
+    return client.active_ ? client.board_ : -1;
+  }
+  if( verb == "start" || verb == "set" )
+  {
+    auto servo = servos_.find(tokens.next().second);
+    return servo != servos_.end() ? servo->second.board_ : -1;
+  }
+  return -1;
+}
+
+std::string ControlServer::command(Client& client, std::string_view line)
+{
+  Tokeniser tokens(line);
+  auto verb = tokens.next().second;
+  if( verb == "update" )
+  {
+    unsigned int value;
+    if( !client.active_ )
+    {
+      return "error,nothing started";
+    }
+    if( !to_value(tokens.next().second, client.max_, value) )
+    {
+      return "error,value must be 0-" + std::to_string(client.max_);
+    }
+    servoController_.update(client.session_, value);
+    return "ok";
+  }
+  if( verb == "finish" )
+  {
+    if( !client.active_ )
+    {
+      return "error,nothing started";
+    }
+    servoController_.finish(client.session_);
+    client.active_ = false;
+    return "ok";
+  }
+  if( verb != "start" && verb != "set" )
+  {
+    return "error,unknown command " + std::string(verb);
+  }
+
+  auto name = tokens.next().second;
+  auto servo = servos_.find(name);
+  if( servo == servos_.end() )
+  {
+    return "error,no lever " + std::string(name);
+  }
+  auto settingName = tokens.next().second;
+  auto setting = std::find_if(
+    std::begin(settings),
+    std::end(settings),
+    [settingName](Setting const& s){ return settingName == s.name_; });
+  if( setting == std::end(settings) )
+  {
+    return "error,no setting " + std::string(settingName);
+  }
+  unsigned int value;
+  if( !to_value(tokens.next().second, setting->max_, value) )
+  {
+    return "error,value must be 0-" + std::to_string(setting->max_);
+  }
+  if( client.active_ )
+  {
+    return "error,finish the active servo first";
+  }
+  if( !servoController_.hasPort(servo->second.board_) )
+  {
+    return "error,no serial port for board " + std::to_string(servo->second.board_);
+  }
+
+  if( verb == "set" )
+  {
+    servoController_.set(
+      servo->second.board_,
+      servo->second.connector_,
+      setting->direction_,
+      setting->function_,
+      value,
+      client.session_);
+  }
+  else
+  {
+    servoController_.start(
+      client.session_,
+      servo->second.board_,
+      servo->second.connector_,
+      setting->direction_,
+      setting->function_,
+      value);
+    client.active_ = true;
+    client.board_ = servo->second.board_;
+    client.max_ = setting->max_;
+  }
+  return "ok";
+}
+
+void ControlServer::disconnect(Client& client)
+{
+  if( client.fd_ < 0 )
+  {
+    return;
+  }
+  if( client.active_ )
+  {
+    servoController_.finish(client.session_);
+    client.active_ = false;
+  }
+  close(client.fd_);
+  client.fd_ = -1;
+}
@@ -0,0 +1,86 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "framecache.h"
+#include "servocontroller.h"
+
+// Lets other programs drive servos while the panel is in use, through a
+// UNIX domain socket served by its own event loop thread. Each client is a
+// session with at most one servo active. Commands are one per line, comma
+// separated like the frame file:
+//   start,<lever>,<setting>,<value>
+//   update,<value>
+//   finish
+//   set,<lever>,<setting>,<value>
+// where setting is normal, reversed, pull or return. Each line is answered
+// with "ok" or "error,<reason>".
+//
+// Clients take turns at running a few lines each, and each link takes
+// turns between sessions at sending values, so however fast a client
+// starts and finishes servos it can't hold up the panel or other clients.
+// A client whose next line is for a link that has fallen behind is neither
+// run nor read from until the link catches up, so a client sending a
+// stream of sets is slowed to what the link can carry rather than
+// stalling the server.
+class ControlServer
+{
+public:
+  ControlServer(
+    std::string const& path,
+    FrameCache const& frame,
+    ServoController& servoController);
+  // finishes any servos clients left active
+  ~ControlServer();
+
+private:
+  struct Servo
+  {
+    int board_;
+    int connector_;
+  };
+
+  struct Client
+  {
+    int fd_;
+    unsigned int session_;
+    bool active_;
+    bool hungUp_;
+    bool held_; // until the link for its next line catches up
+    int board_; // of the active servo
+    int max_; // of the active servo's setting
+    std::string in_;
+    std::string out_;
+  };
+
+  void run();
+  void accept();
+  bool receive(Client& client);
+  bool send(Client& client);
+  // returns false once the client has nothing more to run this turn
+  bool execute(Client& client);
+  // the board line would send to, or -1 if it sends nothing
+  int board(Client const& client, std::string_view line) const;
+  std::string command(Client& client, std::string_view line);
+  void disconnect(Client& client);
+
+private:
+  std::string path_;
+  ServoController& servoController_;
+  std::map<std::string, Servo, std::less<>> servos_;
+  int listenFd_;
+  int wakeFd_;
+  unsigned int nextSession_;
+  std::vector<Client> clients_;
+  std::thread thread_;
+};
+
+#endif // !defined CONTROLSERVER_H
@@ -0,0 +1,149 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined FIELDEDITOR_H
+#define FIELDEDITOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+#include "latency.h"
+
+// Steps arriving in quick succession in the same direction are treated as
+// a button being held and grow from 1 to 2, 5 and then 10 at a time. Steps
+// are accumulated until the next flush() so that however many arrive
+// between frames the value only changes once.
+class FieldEditor
+{
+public:
+  FieldEditor(
+    int curr,
+    int min,
+    int max,
+    std::function<void()> enterField,
+    std::function<void(int newValue)> changeValue,
+    std::function<void(bool changed, int finalValue)> exitField)
+    : curr_(curr)
+    , min_(min)
+    , max_(max)
+    , active_(false)
+    , changed_(false)
+    , pending_(0)
+    , lastDirection_(0)
+    , repeats_(0)
+    , enterField_(std::move(enterField))
+    , changeValue_(std::move(changeValue))
+    , exitField_(std::move(exitField))
+  {
+  }
+
+  ~FieldEditor()
+  {
+    if( active_ )
+    {
+      exit();
+    }
+  }
+
+  void enter()
+  {
+    if( enterField_ )
+    {
+      enterField_();
+    }
+    active_ = true;
+  }
+
+  void exit()
+  {
+    flush();
+    active_ = false;
+    if( exitField_ )
+    {
+      exitField_(changed_, curr_);
+    }
+  }
+
+  void left()
+  {
+    step(-1);
+  }
+
+  void right()
+  {
+    step(1);
+  }
+
+  // applies all the steps taken since the last flush as one change
+  void flush()
+  {
+    if( pending_ != 0 )
+    {
+      auto next = std::min(std::max(curr_ + pending_, min_), max_);
+      pending_ = 0;
+      if( next != curr_ )
+      {
+        curr_ = next;
+        changed_ = true;
+        latency::begin(origin_);
+        latency::record(latency::Edit);
+        if( changeValue_ )
+        {
+          changeValue_(curr_);
+        }
+        latency::begin({});
+      }
+    }
+  }
+
+  bool pending() const
+  {
+    return pending_ != 0;
+  }
+
+  int current()
+  {
+    flush();
+    return curr_;
+  }
+
+private:
+  void step(int direction)
+  {
+    static std::chrono::milliseconds const repeatWindow(150);
+    static int const stepsPerSize = 8;
+    static int const sizes[] = { 1, 2, 5, 10 };
+
+    auto now = std::chrono::steady_clock::now();
+    if( direction == lastDirection_ && now - lastStep_ < repeatWindow )
+    {
+      repeats_++;
+    }
+    else
+    {
+      repeats_ = 0;
+    }
+    lastDirection_ = direction;
+    lastStep_ = now;
+    origin_ = latency::origin();
+
+    pending_ += direction * sizes[std::min(repeats_ / stepsPerSize, 3)];
+  }
+
+  int curr_;
+  int min_;
+  int max_;
+  bool active_;
+  bool changed_;
+  int pending_;
+  int lastDirection_;
+  int repeats_;
+  std::chrono::steady_clock::time_point lastStep_;
+  latency::Clock::time_point origin_;
+  std::function<void()> enterField_;
+  std::function<void(int newValue)> changeValue_;
+  std::function<void(bool changed, int finalValue)> exitField_;
+};
+
+#endif // !defined FIELDEDITOR_H
@@ -0,0 +1,258 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "framecache.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  char const magic[4] = { 'S', 'V', 'F', 'C' };
+  uint32_t const version = 2;
+
+  struct Header
+  {
+    char magic_[4];
+    uint32_t version_;
+    int64_t textMtime_; // nanoseconds
+    uint64_t textSize_;
+    uint32_t leverCount_;
+    uint32_t stringBytes_;
+    uint64_t hash_; // of everything after the header
+  };
+
+  // strings are offsets into the table following the levers
+  struct CachedLever
+  {
+    uint32_t name_;
+    uint32_t nameLength_;
+    uint32_t description_;
+    uint32_t descriptionLength_;
+    int32_t board_;
+    int32_t connector_;
+    int32_t normalPos_;
+    int32_t reversedPos_;
+    int32_t pullSpeed_;
+    int32_t returnSpeed_;
+    char type_;
+    char pad_[3];
+  };
+
+  // FNV-1a taking eight bytes at a time, it only has to catch a damaged
+  // cache and bytewise it would take longer than the rest of a load
+  uint64_t hash(char const* data, std::size_t size)
+  {
+    uint64_t result = 14695981039346656037ull;
+    std::size_t i = 0;
+    for( ; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t) )
+    {
+      uint64_t word;
+      std::memcpy(&word, data + i, sizeof(word));
+      result ^= word;
+      result *= 1099511628211ull;
+    }
+    for( ; i < size; i++ )
+    {
+      result ^= static_cast<unsigned char>(data[i]);
+      result *= 1099511628211ull;
+    }
+    return result;
+  }
+
+  Header header(std::vector<char> const& image)
+  {
+    Header header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    return header;
+  }
+
+  CachedLever cachedLever(std::vector<char> const& image, std::size_t i)
+  {
+    CachedLever cached;
+    std::memcpy(&cached, image.data() + sizeof(Header) + i * sizeof(CachedLever), sizeof(cached));
+    return cached;
+  }
+
+  // the whole cache comes in with a single read
+  bool readImage(std::string const& cachePath, std::vector<char>& image)
+  {
+    auto fd = open(cachePath.c_str(), O_RDONLY);
+    if( fd < 0 )
+    {
+      return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(Header));
+    if( ok )
+    {
+      image.resize(st.st_size);
+      ok = read(fd, image.data(), image.size()) == static_cast<ssize_t>(image.size());
+    }
+    close(fd);
+    return ok;
+  }
+
+  // checks everything operator[] relies on so it needn't check again
+  bool valid(std::vector<char> const& image, int64_t textMtime, uint64_t textSize)
+  {
+    auto h = header(image);
+    auto payloadSize = image.size() - sizeof(Header);
+    if( std::memcmp(h.magic_, magic, sizeof(magic)) != 0 ||
+        h.version_ != version ||
+        h.textMtime_ != textMtime ||
+        h.textSize_ != textSize ||
+        payloadSize != static_cast<uint64_t>(h.leverCount_) * sizeof(CachedLever) + h.stringBytes_ ||
+        h.hash_ != hash(image.data() + sizeof(Header), payloadSize) )
+    {
+      return false;
+    }
+    for( uint32_t i = 0; i < h.leverCount_; i++ )
+    {
+      auto cached = cachedLever(image, i);
+      if( static_cast<uint64_t>(cached.name_) + cached.nameLength_ > h.stringBytes_ ||
+          static_cast<uint64_t>(cached.description_) + cached.descriptionLength_ > h.stringBytes_ )
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+FrameCache::FrameCache(std::vector<LeverRecord> const& levers)
+  : image_(sizeof(Header) + levers.size() * sizeof(CachedLever))
+  , size_(levers.size())
+{
+  std::string strings;
+  for( std::size_t i = 0; i < levers.size(); i++ )
+  {
+    auto& lever = levers[i];
+    CachedLever cached{};
+    cached.name_ = strings.size();
+    cached.nameLength_ = lever.name_.size();
+    strings += lever.name_;
+    cached.description_ = strings.size();
+    cached.descriptionLength_ = lever.description_.size();
+    strings += lever.description_;
+    cached.board_ = lever.board_;
+    cached.connector_ = lever.connector_;
+    cached.normalPos_ = lever.normalPos_;
+    cached.reversedPos_ = lever.reversedPos_;
+    cached.pullSpeed_ = lever.pullSpeed_;
+    cached.returnSpeed_ = lever.returnSpeed_;
+    cached.type_ = lever.type_;
+    std::memcpy(image_.data() + sizeof(Header) + i * sizeof(CachedLever), &cached, sizeof(cached));
+  }
+  image_.insert(image_.end(), strings.begin(), strings.end());
+
+  Header h{};
+  std::memcpy(h.magic_, magic, sizeof(magic));
+  h.version_ = version;
+  h.leverCount_ = size_;
+  h.stringBytes_ = strings.size();
+  std::memcpy(image_.data(), &h, sizeof(h));
+}
+
+FrameCache::FrameCache(std::vector<char> image)
+  : image_(std::move(image))
+  , size_(header(image_).leverCount_)
+{
+}
+
+FrameCache FrameCache::load(std::string const& framePath, framefile::ErrorHandler const& onError)
+{
+  // taken before the text is read, so if it changes while it is being
+  // parsed the cache is made stale rather than wrong
+  struct stat st;
+  if( stat(framePath.c_str(), &st) < 0 )
+  {
+    throw std::runtime_error(framePath + ": " + std::strerror(errno));
+  }
+  int64_t textMtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  uint64_t textSize = st.st_size;
+
+  std::vector<char> image;
+  if( readImage(path(framePath), image) && valid(image, textMtime, textSize) )
+  {
+    return FrameCache(std::move(image));
+  }
+
+  // a cache made from a frame with errors would stop them being reported
+  bool clean = true;
+  FrameCache frame(
+    framefile::load(
+      framePath,
+      [&clean, &onError](FrameError const& e)
+      {
+        clean = false;
+        if( onError )
+        {
+          onError(e);
+        }
+      }));
+  if( clean )
+  {
+    frame.save(framePath, textMtime, textSize);
+  }
+  return frame;
+}
+
+std::string FrameCache::path(std::string const& framePath)
+{
+  return framePath + ".cache";
+}
+
+std::size_t FrameCache::size() const
+{
+  return size_;
+}
+
+bool FrameCache::empty() const
+{
+  return size_ == 0;
+}
+
+LeverView FrameCache::operator[](std::size_t i) const
+{
+  auto cached = cachedLever(image_, i);
+  auto strings = image_.data() + sizeof(Header) + size_ * sizeof(CachedLever);
+  return {
+    {strings + cached.name_, cached.nameLength_},
+    cached.board_,
+    cached.connector_,
+    cached.type_,
+    cached.normalPos_,
+    cached.reversedPos_,
+    cached.pullSpeed_,
+    cached.returnSpeed_,
+    {strings + cached.description_, cached.descriptionLength_}};
+}
+
+void FrameCache::save(std::string const& framePath, int64_t textMtime, uint64_t textSize)
+{
+  auto h = header(image_);
+  h.textMtime_ = textMtime;
+  h.textSize_ = textSize;
+  h.hash_ = hash(image_.data() + sizeof(Header), image_.size() - sizeof(Header));
+  std::memcpy(image_.data(), &h, sizeof(h));
+
+  auto cachePath = path(framePath);
+  auto tmpPath = cachePath + ".tmp";
+  auto fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if( fd < 0 )
+  {
+    return;
+  }
+  bool ok = write(fd, image_.data(), image_.size()) == static_cast<ssize_t>(image_.size());
+  ok = close(fd) == 0 && ok;
+  if( !ok || rename(tmpPath.c_str(), cachePath.c_str()) < 0 )
+  {
+    unlink(tmpPath.c_str());
+  }
+}
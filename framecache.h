@@ -0,0 +1,48 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined FRAMECACHE_H
+#define FRAMECACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "framefile.h"
+
+// The levers of a frame in a compact layout: a header, a fixed size record
+// for each lever and a table holding all of their names and descriptions.
+// The same layout is kept alongside the frame file as <frame>.cache so
+// that large frames load with a single read and no parsing. The cache
+// records the modification time and size of the text it was made from and
+// is ignored once the text has changed. It is in native byte order and
+// only meant for the machine that wrote it.
+class FrameCache
+{
+public:
+  // levers that didn't come from a file, no cache is written
+  explicit FrameCache(std::vector<LeverRecord> const& levers);
+
+  // Loads framePath from its cache if that was made from the current
+  // text, otherwise parses the text, passing bad lines to onError, and
+  // refreshes the cache if every line parsed.
+  static FrameCache load(std::string const& framePath, framefile::ErrorHandler const& onError);
+  static std::string path(std::string const& framePath);
+
+  std::size_t size() const;
+  bool empty() const;
+  // valid for as long as the FrameCache
+  LeverView operator[](std::size_t i) const;
+
+private:
+  FrameCache(std::vector<char> image);
+
+  // Stamps the image with the text it was made from and writes it. Best
+  // effort, a cache that can't be written is simply not used.
+  void save(std::string const& framePath, int64_t textMtime, uint64_t textSize);
+
+  std::vector<char> image_;
+  std::size_t size_;
+};
+
+#endif // !defined FRAMECACHE_H
@@ -0,0 +1,316 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "framefile.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tokeniser.h"
+
+namespace
+{
+  // Read only view of a whole file
+  class MappedFile
+  {
+  public:
+    MappedFile(std::string const& path)
+      : data_(nullptr)
+      , size_(0)
+    {
+      auto fd = open(path.c_str(), O_RDONLY);
+      if( fd < 0 )
+      {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+      }
+
+      struct stat st;
+      if( fstat(fd, &st) == 0 && st.st_size > 0 )
+      {
+        auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if( data != MAP_FAILED )
+        {
+          data_ = data;
+          size_ = st.st_size;
+          madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+      }
+      close(fd);
+    }
+
+    ~MappedFile()
+    {
+      if( data_ != nullptr )
+      {
+        munmap(data_, size_);
+      }
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    std::string_view text() const
+    {
+      return {static_cast<char const*>(data_), size_};
+    }
+
+  private:
+    void* data_;
+    std::size_t size_;
+  };
+
+  class LineParser
+  {
+  public:
+    LineParser(std::string_view line, unsigned int lineNo)
+      : fields_(line)
+      , length_(line.size())
+      , lineNo_(lineNo)
+      , trimmed_(0)
+    {
+    }
+
+    // the next field without the spaces or tabs around it
+    std::string_view string(char const* what)
+    {
+      auto field = fields_.next();
+      if( !field.first )
+      {
+        error(std::string("missing ") + what, length_);
+      }
+      auto str = field.second;
+      auto start = str.find_first_not_of(" \t");
+      str.remove_prefix(start == std::string_view::npos ? str.size() : start);
+      trimmed_ = field.second.size() - str.size();
+      auto end = str.find_last_not_of(" \t");
+      str.remove_suffix(str.size() - (end == std::string_view::npos ? 0 : end + 1));
+      return str;
+    }
+
+    int integer(char const* what)
+    {
+      auto str = string(what);
+      int value = 0;
+      auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+      if( result.ec != std::errc() || result.ptr != str.data() + str.size() || str.empty() )
+      {
+        error(std::string("invalid ") + what + " '" + std::string(str) + "'",
+              offset() + (result.ptr - str.data()));
+      }
+      return value;
+    }
+
+    char type()
+    {
+      auto str = string("type");
+      if( str.size() != 1 || std::strchr("SPF-", str[0]) == nullptr )
+      {
+        error("invalid type '" + std::string(str) + "', expected S, P, F or -",
+              offset());
+      }
+      return str[0];
+    }
+
+    std::string_view remainder()
+    {
+      return fields_.remainder();
+    }
+
+  private:
+    // offset into the line of the last field, after any leading spaces
+    std::size_t offset() const
+    {
+      return fields_.offset() + trimmed_;
+    }
+
+    [[noreturn]] void error(std::string const& what, std::size_t offset)
+    {
+      throw FrameError(what, lineNo_, offset + 1);
+    }
+
+    Tokeniser fields_;
+    std::size_t length_;
+    unsigned int lineNo_;
+    std::size_t trimmed_;
+  };
+
+  // Calls f(line, lineNo) for each line of text, without its line ending
+  template<typename F>
+  void forEachLine(std::string_view text, F&& f)
+  {
+    unsigned int lineNo = 0;
+    while( !text.empty() )
+    {
+      auto end = text.find('\n');
+      auto line = text.substr(0, end);
+      text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+      lineNo++;
+
+      if( !line.empty() && line.back() == '\r' )
+      {
+        line.remove_suffix(1);
+      }
+      f(line, lineNo);
+    }
+  }
+
+  bool isLever(std::string_view line)
+  {
+    return !line.empty() && line[0] != '#';
+  }
+
+  // throws FrameError
+  LeverRecord parseLever(std::string_view line, unsigned int lineNo)
+  {
+    LineParser fields(line, lineNo);
+    LeverRecord lever;
+    lever.name_ = fields.string("name");
+    lever.board_ = fields.integer("board");
+    lever.connector_ = fields.integer("servo");
+    lever.type_ = fields.type();
+    lever.normalPos_ = fields.integer("normal position");
+    lever.reversedPos_ = fields.integer("reversed position");
+    lever.pullSpeed_ = fields.integer("pull speed");
+    lever.returnSpeed_ = fields.integer("return speed");
+    lever.description_ = fields.remainder();
+    return lever;
+  }
+}
+
+std::vector<LeverRecord> framefile::load(
+  std::string const& path,
+  ErrorHandler const& onError)
+{
+  MappedFile file(path);
+  return parse(file.text(), onError);
+}
+
+std::vector<LeverRecord> framefile::parse(
+  std::string_view text,
+  ErrorHandler const& onError)
+{
+  std::vector<LeverRecord> levers;
+  forEachLine(
+    text,
+    [&](std::string_view line, unsigned int lineNo)
+    {
+      if( !isLever(line) )
+      {
+        return;
+      }
+      try
+      {
+        levers.push_back(parseLever(line, lineNo));
+      }
+      catch(FrameError const& e)
+      {
+        if( onError )
+        {
+          onError(e);
+        }
+      }
+    });
+  return levers;
+}
+
+void framefile::save(
+  std::string const& path,
+  std::vector<LeverRecord> const& levers)
+{
+  // The levers replace the lines that parse as levers, in order. Comments,
+  // blank lines and lines that failed to parse are kept as they were, as
+  // are any lever lines beyond the last lever.
+  std::ostringstream os;
+  auto next = levers.begin();
+  struct stat st;
+  bool exists = stat(path.c_str(), &st) == 0;
+  if( exists )
+  {
+    MappedFile old(path);
+    forEachLine(
+      old.text(),
+      [&](std::string_view line, unsigned int lineNo)
+      {
+        if( next != levers.end() && isLever(line) )
+        {
+          try
+          {
+            parseLever(line, lineNo);
+            write(os, *next++);
+            return;
+          }
+          catch(FrameError const&)
+          {
+          }
+        }
+        os << line << '\n';
+      });
+  }
+  else
+  {
+    os << "# Name,Board,servo,Type(S|P|F|-),Normal-pos,Reversed-pos,Pull-speed,"
+       << "Return-speed,Description" << std::endl;
+  }
+  for( ; next != levers.end(); ++next )
+  {
+    write(os, *next);
+  }
+  auto text = os.str();
+
+  // write a new file alongside and swap it in so that the frame file is
+  // never left half written
+  auto tmpPath = path + ".tmp";
+  auto mode = exists ? st.st_mode & 07777 : 0644;
+  auto fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+  if( fd < 0 )
+  {
+    throw std::runtime_error(tmpPath + ": " + std::strerror(errno));
+  }
+
+  std::size_t written = 0;
+  while( written < text.size() )
+  {
+    auto n = ::write(fd, text.data() + written, text.size() - written);
+    if( n < 0 && errno != EINTR )
+    {
+      break;
+    }
+    written += n > 0 ? n : 0;
+  }
+  bool ok = written == text.size() && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if( !ok || rename(tmpPath.c_str(), path.c_str()) < 0 )
+  {
+    auto error = errno;
+    unlink(tmpPath.c_str());
+    throw std::runtime_error(path + ": " + std::strerror(error));
+  }
+
+  auto slash = path.rfind('/');
+  auto dir = slash == std::string::npos ? std::string(".") : path.substr(0, slash + 1);
+  auto dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if( dirFd >= 0 )
+  {
+    fsync(dirFd);
+    close(dirFd);
+  }
+}
+
+void framefile::write(std::ostream& os, LeverRecord const& lever)
+{
+  os << lever.name_ << ','
+     << lever.board_ << ','
+     << lever.connector_ << ','
+     << lever.type_ << ','
+     << lever.normalPos_ << ','
+     << lever.reversedPos_ << ','
+     << lever.pullSpeed_ << ','
+     << lever.returnSpeed_ << ','
+     << lever.description_ << '\n';
+}
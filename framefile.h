@@ -0,0 +1,75 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined FRAMEFILE_H
+#define FRAMEFILE_H
+
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One line of a frame file
+template<typename String>
+struct BasicLeverRecord
+{
+  String name_;
+  int board_;
+  int connector_;
+  char type_; // S, P, F or -
+  int normalPos_;
+  int reversedPos_;
+  int pullSpeed_;
+  int returnSpeed_;
+  String description_;
+};
+
+using LeverRecord = BasicLeverRecord<std::string>;
+// the strings belong to whatever the lever was read from
+using LeverView = BasicLeverRecord<std::string_view>;
+
+// A badly formatted line, line and column count from 1
+class FrameError : public std::runtime_error
+{
+public:
+  FrameError(std::string const& what, unsigned int line, unsigned int column)
+    : std::runtime_error(
+        std::to_string(line) + ":" + std::to_string(column) + ": " + what)
+    , line_(line)
+    , column_(column)
+  {
+  }
+
+  unsigned int line() const
+  {
+    return line_;
+  }
+
+  unsigned int column() const
+  {
+    return column_;
+  }
+
+private:
+  unsigned int line_;
+  unsigned int column_;
+};
+
+// Reading and writing frame files. Lines that fail to parse are passed to
+// onError and skipped.
+namespace framefile
+{
+  using ErrorHandler = std::function<void(FrameError const&)>;
+
+  std::vector<LeverRecord> load(std::string const& path, ErrorHandler const& onError);
+  std::vector<LeverRecord> parse(std::string_view text, ErrorHandler const& onError);
+
+  // Replaces the file atomically. The levers take the place of the lines
+  // that parse as levers, everything else in the file is kept.
+  void save(std::string const& path, std::vector<LeverRecord> const& levers);
+  void write(std::ostream& os, LeverRecord const& lever);
+}
+
+#endif // !defined FRAMEFILE_H
@@ -0,0 +1,126 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "glyphatlas.h"
+
+#include "perf.h"
+
+GlyphAtlas::GlyphAtlas(sdl::ttf::font const& font, SDL_Color const& colour)
+  : font_(font)
+  , colour_(colour)
+  , digits_(nullptr, nullptr)
+  , digitHeight_(0)
+{
+}
+
+int GlyphAtlas::lineSkip() const
+{
+  return TTF_FontLineSkip(font_.get());
+}
+
+SDL_Rect const& GlyphAtlas::textSize(
+  sdl::renderer const& renderer,
+  std::string const& str)
+{
+  return text(renderer, str).size_;
+}
+
+int GlyphAtlas::numberWidth(sdl::renderer const& renderer, unsigned int value)
+{
+  createDigits(renderer);
+  int width = 0;
+  do
+  {
+    auto digit = value % 10;
+    width += digitX_[digit + 1] - digitX_[digit];
+    value /= 10;
+  }
+  while( value != 0 );
+  return width;
+}
+
+int GlyphAtlas::drawText(
+  sdl::renderer const& renderer,
+  std::string const& str,
+  int x,
+  int y)
+{
+  auto& t = text(renderer, str);
+  if( t.texture_ )
+  {
+    SDL_Rect pos{x, y, t.size_.w, t.size_.h};
+    sdl::render_copy(renderer, t.texture_, nullptr, &pos);
+  }
+  return x + t.size_.w;
+}
+
+int GlyphAtlas::drawNumber(
+  sdl::renderer const& renderer,
+  unsigned int value,
+  int x,
+  int y)
+{
+  createDigits(renderer);
+
+  int digits[10];
+  int count = 0;
+  do
+  {
+    digits[count++] = value % 10;
+    value /= 10;
+  }
+  while( value != 0 );
+
+  while( count-- > 0 )
+  {
+    auto digit = digits[count];
+    SDL_Rect src{
+      digitX_[digit],
+      0,
+      digitX_[digit + 1] - digitX_[digit],
+      digitHeight_};
+    SDL_Rect dst{x, y, src.w, src.h};
+    sdl::render_copy(renderer, digits_, &src, &dst);
+    x += src.w;
+  }
+  return x;
+}
+
+void GlyphAtlas::clear()
+{
+  texts_.clear();
+  digits_.reset();
+}
+
+GlyphAtlas::Text& GlyphAtlas::text(
+  sdl::renderer const& renderer,
+  std::string const& str)
+{
+  auto& t = texts_[str];
+  if( !t.texture_ && !str.empty() )
+  {
+    perf::Timer timer(perf::TextTime);
+    auto surface = sdl::ttf::render_blended(font_, str, colour_);
+    t.texture_ = sdl::create_texture_from_surface(renderer, surface);
+    perf::add(perf::Textures);
+    sdl::ttf::size(font_, str, &t.size_.w, &t.size_.h);
+  }
+  return t;
+}
+
+void GlyphAtlas::createDigits(sdl::renderer const& renderer)
+{
+  if( !digits_ )
+  {
+    std::string const strip = "0123456789";
+    digitX_[0] = 0;
+    for( int digit = 1; digit <= 10; digit++ )
+    {
+      sdl::ttf::size(font_, strip.substr(0, digit), &digitX_[digit], &digitHeight_);
+    }
+    perf::Timer timer(perf::TextTime);
+    auto surface = sdl::ttf::render_blended(font_, strip, colour_);
+    digits_ = sdl::create_texture_from_surface(renderer, surface);
+    perf::add(perf::Textures);
+  }
+}
@@ -0,0 +1,60 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include "sdl2-cpp/sdl2.h"
+#include "sdl2-cpp/ttf.h"
+
+#include <map>
+#include <string>
+
+// Caches rendered text so that nothing is rasterised or uploaded when a
+// value changes. Fixed strings are rendered once each, numbers are drawn
+// digit by digit from a single strip holding 0-9.
+class GlyphAtlas
+{
+public:
+  GlyphAtlas(sdl::ttf::font const& font, SDL_Color const& colour);
+
+  int lineSkip() const;
+
+  // size of str, rendering it if this is the first time it has been used
+  SDL_Rect const& textSize(sdl::renderer const& renderer, std::string const& str);
+  int numberWidth(sdl::renderer const& renderer, unsigned int value);
+
+  // draw with top left at x, y, returning the x following the text
+  int drawText(sdl::renderer const& renderer, std::string const& str, int x, int y);
+  int drawNumber(sdl::renderer const& renderer, unsigned int value, int x, int y);
+
+  // drops every texture, for when the renderer has lost them, so that
+  // they are rendered again as they are next used
+  void clear();
+
+private:
+  struct Text
+  {
+    Text()
+      : texture_(nullptr, nullptr)
+      , size_{0, 0, 0, 0}
+    {
+    }
+
+    sdl::texture texture_;
+    SDL_Rect size_;
+  };
+
+  Text& text(sdl::renderer const& renderer, std::string const& str);
+  void createDigits(sdl::renderer const& renderer);
+
+  sdl::ttf::font const& font_;
+  SDL_Color colour_;
+  std::map<std::string, Text> texts_;
+  sdl::texture digits_;
+  // digit d occupies [digitX_[d], digitX_[d + 1]) in the strip
+  int digitX_[11];
+  int digitHeight_;
+};
+
+#endif // !defined GLYPHATLAS_H
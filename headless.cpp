@@ -0,0 +1,200 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "headless.h"
+
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "framefile.h"
+#include "servocontroller.h"
+
+using namespace std::chrono_literals;
+
+namespace
+{
+  // long enough for a few hundred levers at 1200 baud
+  auto const applyTimeout = 300s;
+  int const connectors = 4;
+
+  // each lever sets these on its servo, in this order
+  struct Setting
+  {
+    ServoController::Direction direction_;
+    ServoController::Function function_;
+    int LeverRecord::* value_;
+    int max_;
+    char const* name_;
+  };
+
+  Setting const settings[] =
+  {
+    { ServoController::Normal, ServoController::Position, &LeverRecord::normalPos_, 255, "normal position" },
+    { ServoController::Reversed, ServoController::Position, &LeverRecord::reversedPos_, 255, "reversed position" },
+    { ServoController::Normal, ServoController::Speed, &LeverRecord::pullSpeed_, 6, "pull speed" },
+    { ServoController::Reversed, ServoController::Speed, &LeverRecord::returnSpeed_, 6, "return speed" }
+  };
+
+  struct Frame
+  {
+    std::vector<LeverRecord> levers_;
+    std::vector<bool> valid_;
+    unsigned int spare_;
+    unsigned int problems_;
+  };
+
+  // loads the frame and reports anything the boards would not accept
+  Frame survey(std::string const& framePath)
+  {
+    Frame frame{{}, {}, 0, 0};
+    frame.levers_ = framefile::load(
+      framePath,
+      [&framePath, &frame](FrameError const& e)
+      {
+        std::cerr << framePath << ":" << e.what() << std::endl;
+        frame.problems_++;
+      });
+
+    std::map<std::pair<int,int>, std::string> servos;
+    for( auto&& lever : frame.levers_ )
+    {
+      auto report = [&](std::string const& problem)
+                    {
+                      std::cerr << framePath << ": " << lever.name_ << ": " << problem << std::endl;
+                      frame.problems_++;
+                    };
+      bool valid = true;
+      if( lever.type_ == '-' )
+      {
+        frame.spare_++;
+        valid = false;
+      }
+      else
+      {
+        if( lever.board_ < 0 || lever.connector_ < 0 || lever.connector_ >= connectors )
+        {
+          report("no connector " + std::to_string(lever.connector_) +
+                 " on board " + std::to_string(lever.board_));
+          valid = false;
+        }
+        for( auto&& setting : settings )
+        {
+          auto value = lever.*setting.value_;
+          if( value < 0 || value > setting.max_ )
+          {
+            report(std::string(setting.name_) + " " + std::to_string(value) +
+                   " outside 0-" + std::to_string(setting.max_));
+            valid = false;
+          }
+        }
+        if( valid )
+        {
+          auto servo = servos.emplace(
+            std::make_pair(lever.board_, lever.connector_),
+            lever.name_);
+          if( !servo.second )
+          {
+            report("shares its servo with " + servo.first->second);
+          }
+        }
+      }
+      frame.valid_.push_back(valid);
+    }
+    return frame;
+  }
+
+  void writeSummary(std::ostream& os, Frame const& frame, unsigned int applied)
+  {
+    os << "Levers " << frame.levers_.size()
+       << ", " << applied << (applied == 1 ? " servo" : " servos")
+       << ", " << frame.spare_ << " spare"
+       << ", " << frame.problems_ << (frame.problems_ == 1 ? " problem" : " problems")
+       << ", " << applied * std::size(settings) * 2 << " packets"
+       << std::endl;
+  }
+}
+
+int headless::verify(std::string const& framePath, std::ostream& os)
+{
+  auto frame = survey(framePath);
+  unsigned int valid = 0;
+  for( bool v : frame.valid_ )
+  {
+    valid += v ? 1 : 0;
+  }
+  writeSummary(os, frame, valid);
+  return frame.problems_ == 0 ? 0 : 1;
+}
+
+int headless::apply(
+  std::string const& framePath,
+  ServoController& servoController,
+  std::ostream& os)
+{
+  auto frame = survey(framePath);
+
+  // everything is queued up front, each board's link writes its share
+  // back to back while the others do the same
+  auto started = std::chrono::steady_clock::now();
+  unsigned int applied = 0;
+  std::set<int> portless;
+  for( std::size_t i = 0; i < frame.levers_.size(); i++ )
+  {
+    if( frame.valid_[i] )
+    {
+      auto& lever = frame.levers_[i];
+      // the settings would be dropped without anything being written
+      if( !servoController.hasPort(lever.board_) )
+      {
+        if( portless.insert(lever.board_).second )
+        {
+          std::cerr << framePath << ": board " << lever.board_ << " has no serial port" << std::endl;
+          frame.problems_++;
+        }
+        continue;
+      }
+      for( auto&& setting : settings )
+      {
+        servoController.set(
+          lever.board_,
+          lever.connector_,
+          setting.direction_,
+          setting.function_,
+          lever.*setting.value_);
+      }
+      applied++;
+    }
+  }
+  bool written = servoController.wait(applyTimeout);
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - started);
+
+  writeSummary(os, frame, applied);
+  if( !written )
+  {
+    os << "Gave up waiting for the serial ports after " << elapsed.count() << "ms" << std::endl;
+    return 2;
+  }
+  // a link whose writes fail still empties its queues, so waiting for it
+  // doesn't show that anything was lost
+  bool failed = false;
+  for( auto&& link : servoController.stats() )
+  {
+    if( link.second.writeErrors_ != 0 )
+    {
+      os << link.first << ": " << link.second.writeErrors_ << " writes failed" << std::endl;
+      failed = true;
+    }
+  }
+  if( failed )
+  {
+    return 2;
+  }
+  os << "Written in " << elapsed.count() << "ms" << std::endl;
+  return frame.problems_ == 0 ? 0 : 1;
+}
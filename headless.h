@@ -0,0 +1,26 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined HEADLESS_H
+#define HEADLESS_H
+
+#include <ostream>
+#include <string>
+
+class ServoController;
+
+// Batch operations on a whole frame file for scripts, without SDL. Both
+// print a summary to os and return the process exit status.
+namespace headless
+{
+  // checks every lever's settings without touching the boards, which
+  // cannot be read back
+  int verify(std::string const& framePath, std::ostream& os);
+  // sends and stores every lever's positions and speeds on its board
+  int apply(
+    std::string const& framePath,
+    ServoController& servoController,
+    std::ostream& os);
+}
+
+#endif // !defined HEADLESS_H
@@ -0,0 +1,122 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "latency.h"
+
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+
+namespace
+{
+  // Buckets are a quarter of an octave wide, from 1us up to over an hour
+  class Histogram
+  {
+  public:
+    static int const bucketsPerOctave = 4;
+    static int const bucketCount = 32 * bucketsPerOctave;
+
+    Histogram()
+      : count_(0)
+      , max_(0)
+    {
+      for( auto&& bucket : buckets_ )
+      {
+        bucket = 0;
+      }
+    }
+
+    void add(unsigned long long us)
+    {
+      auto bucket = static_cast<int>(std::log2(us + 1) * bucketsPerOctave);
+      buckets_[bucket < bucketCount ? bucket : bucketCount - 1]++;
+      count_++;
+      auto max = max_.load(std::memory_order_relaxed);
+      while( us > max &&
+             !max_.compare_exchange_weak(max, us, std::memory_order_relaxed) )
+      {
+      }
+    }
+
+    unsigned long long count() const
+    {
+      return count_;
+    }
+
+    unsigned long long max() const
+    {
+      return max_;
+    }
+
+    // upper bound of the bucket containing the given percentile
+    double percentile(double p) const
+    {
+      auto target = static_cast<unsigned long long>(std::ceil(count_ * p));
+      unsigned long long seen = 0;
+      for( int i = 0; i < bucketCount; i++ )
+      {
+        seen += buckets_[i];
+        if( seen >= target )
+        {
+          return std::exp2(static_cast<double>(i + 1) / bucketsPerOctave) - 1;
+        }
+      }
+      return max_;
+    }
+
+  private:
+    std::atomic<unsigned long long> buckets_[bucketCount];
+    std::atomic<unsigned long long> count_;
+    std::atomic<unsigned long long> max_;
+  };
+
+  Histogram histograms[latency::StageCount];
+  latency::Clock::time_point current;
+
+  char const* const stageNames[latency::StageCount] =
+  {
+    "dispatch",
+    "edit",
+    "update",
+    "write"
+  };
+}
+
+void latency::begin(Clock::time_point origin)
+{
+  current = origin;
+}
+
+latency::Clock::time_point latency::origin()
+{
+  return current;
+}
+
+void latency::record(Stage stage, Clock::time_point origin)
+{
+  if( origin != Clock::time_point() )
+  {
+    auto elapsed = Clock::now() - origin;
+    histograms[stage].add(
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  }
+}
+
+void latency::write(std::ostream& os)
+{
+  os << "Latency since input (us)" << std::endl;
+  for( int i = 0; i < StageCount; i++ )
+  {
+    auto& histogram = histograms[i];
+    os << std::setw(10) << stageNames[i]
+       << ": count " << histogram.count();
+    if( histogram.count() > 0 )
+    {
+      os << std::fixed << std::setprecision(1)
+         << ", p50 <" << histogram.percentile(0.5)
+         << ", p99 <" << histogram.percentile(0.99)
+         << ", max " << histogram.max();
+    }
+    os << std::endl;
+  }
+}
@@ -0,0 +1,45 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined LATENCY_H
+#define LATENCY_H
+
+#include <chrono>
+#include <ostream>
+
+// Records how long after an input each stage of handling it was reached.
+// An input is started on the UI thread by begin(), each stage then records
+// the time elapsed since that origin. Recording is lock free and may be
+// done from any thread.
+namespace latency
+{
+  using Clock = std::chrono::steady_clock;
+
+  enum Stage
+  {
+    Dispatch, // SDL event taken off the queue
+    Edit,     // FieldEditor step applied
+    Update,   // ServoController::update called
+    Write,    // packet carrying the value written to the port
+    StageCount
+  };
+
+  // Set the origin of the input now being handled by the UI thread
+  void begin(Clock::time_point origin);
+
+  // Origin of the input being handled by the UI thread, or a default
+  // constructed time_point if there isn't one
+  Clock::time_point origin();
+
+  void record(Stage stage, Clock::time_point origin);
+
+  inline void record(Stage stage)
+  {
+    record(stage, origin());
+  }
+
+  // Writes p50/p99/max for each stage
+  void write(std::ostream& os);
+}
+
+#endif // !defined LATENCY_H
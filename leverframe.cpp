@@ -3,145 +3,263 @@
 
 #include "leverframe.h"
 
-#include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <chrono>
 #include <map>
 #include <string>
 
 #include <SDL2/SDL2_gfxPrimitives.h>
 
-class FieldEditor
+#include "fieldeditor.h"
+#include "perf.h"
+
+LeverFrame::LeverFrame(
+  std::string const& framePath,
+  FrameCache const& frame,
+  std::string const& fontFile,
+  SDL_Rect const& pos,
+  ServoController& servoController)
+  : framePath_(framePath)
+  , pos_(pos)
+  , leverFont_(sdl::ttf::open_font(fontFile.c_str(), 18))
+  , glyphs_(leverFont_, sdl::grey)
+  , canvas_(nullptr, nullptr)
+  , background_(nullptr, nullptr)
+  , saver_(framePath)
+  , lastSave_(std::chrono::steady_clock::now())
+  , first_(0)
+  , redrawAll_(true)
+  , selected_(0)
+  , servoController_(servoController)
+  , overlay_(false)
+  , overlayDirty_(false)
+  , rates_{}
 {
-public:
-  FieldEditor(
-    int curr,
-    int min,
-    int max,
-    std::function<void()> enterField,
-    std::function<void(int newValue)> changeValue,
-    std::function<void(bool changed, int finalValue)> exitField)
-    : curr_(curr)
-    , min_(min)
-    , max_(max)
-    , active_(false)
-    , changed_(false)
-    , enterField_(std::move(enterField))
-    , changeValue_(std::move(changeValue))
-    , exitField_(std::move(exitField))
+  if( !leverFont_ )
   {
+    std::string msg = "Failed to open font " + fontFile + + ": " + TTF_GetError();
+    throw std::runtime_error(msg);
   }
 
-  ~FieldEditor()
-  {
-    if( active_ )
+  createLevers(frame, servoController);
+  layoutLevers();
+
+  // with no levers the selector has nowhere to go and never changes
+  leverSelector_ = std::make_shared<FieldEditor>(
+    0,
+    0,
+    std::max(static_cast<int>(levers_.size()) - 1, 0),
+    std::function<void()>(),
+    [this](int newValue)
     {
-      exit();
-    }
+      levers_[selected_].invalidate();
+      selected_ = newValue;
+      levers_[selected_].invalidate();
+      scrollToSelected();
+    },
+    std::function<void(bool,int)>());
+  currentField_ = leverSelector_;
+}
+
+LeverFrame::~LeverFrame()
+{
+  currentField_->flush();
+  saveFrame();
+}
+
+bool LeverFrame::dirty() const
+{
+  // a frame with no levers has nothing to draw
+  if( levers_.empty() )
+  {
+    return false;
   }
 
-  void enter()
+  bool dirty = redrawAll_ ||
+    overlayDirty_ ||
+    (overlay_ && perf::sampleDue()) ||
+    currentField_->pending() ||
+    levers_[selected_].fieldsDirty();
+  for( int i = first_; i < endVisible(); i++ )
   {
-    if( enterField_ )
-    {
-      enterField_();
-    }
-    active_ = true;
+    dirty = dirty || levers_[i].dirty();
+  }
+  return dirty;
+}
+
+bool LeverFrame::render(sdl::renderer const& renderer)
+{
+  // all the steps since the last frame become a single change
+  currentField_->flush();
+  if( !dirty() )
+  {
+    return false;
   }
+  perf::Timer timer(perf::FrameTime);
+  perf::add(perf::Frames);
 
-  void exit()
+  auto& selected = levers_[selected_];
+
+  // the frame is drawn into a persistent texture so that only the parts
+  // that have changed need to be redrawn
+  if( !canvas_ )
   {
-    active_ = false;
-    if( exitField_ )
+    canvas_ = createTarget(renderer, pos_.x + pos_.w, pos_.y + pos_.h);
+    redrawAll_ = true;
+  }
+
+  // the parts of the frame that don't change are drawn once and copied
+  // from there
+  SDL_Rect framePos = pos_;
+  framePos.h = Lever::height() * 3 / 2;
+  if( !background_ )
+  {
+    background_ = createTarget(renderer, framePos.x + framePos.w, framePos.y + framePos.h);
+    SDL_SetRenderTarget(renderer.get(), background_.get());
+    SDL_SetRenderDrawColor(renderer.get(), 0x00, 0x00, 0x00, 0xFF);
+    SDL_RenderClear(renderer.get());
+    sdl::render_set_colour(renderer, sdl::grey);
+    SDL_RenderFillRect(renderer.get(), &framePos);
+    for( int i = first_; i < endVisible(); i++ )
     {
-      exitField_(changed_, curr_);
+      levers_[i].renderBody(renderer);
     }
+    redrawAll_ = true;
   }
 
-  void left()
+  SDL_SetRenderTarget(renderer.get(), canvas_.get());
+
+  if( redrawAll_ )
   {
-    if( curr_ > min_ )
+    SDL_SetRenderDrawColor(renderer.get(), 0x00, 0x00, 0x00, 0xFF);
+    SDL_RenderClear(renderer.get());
+    sdl::render_copy(renderer, background_, &framePos, &framePos);
+    for( int i = first_; i < endVisible(); i++ )
     {
-      curr_--;
-      changed_ = true;
-      if( changeValue_ )
-      {
-        changeValue_(curr_);
-      }
+      levers_[i].invalidate();
     }
+    redrawAll_ = false;
   }
 
-  void right()
+  for( int i = first_; i < endVisible(); i++ )
   {
-    if( curr_ < max_ )
+    if( levers_[i].dirty() )
     {
-      curr_++;
-      changed_ = true;
-      if( changeValue_ )
-      {
-        changeValue_(curr_);
-      }
+      levers_[i].render(renderer, background_, i == selected_);
     }
   }
 
-  int current()
+  if( selected.fieldsDirty() )
   {
-    return curr_;
+    SDL_Rect fieldsPos = pos_;
+    fieldsPos.y += Lever::height() * 3 / 2;
+    fieldsPos.h -= Lever::height() * 3 / 2;
+    SDL_SetRenderDrawColor(renderer.get(), 0x00, 0x00, 0x00, 0xFF);
+    SDL_RenderFillRect(renderer.get(), &fieldsPos);
+    selected.renderFields(renderer);
   }
 
-private:
-  int curr_;
-  int min_;
-  int max_;
-  bool active_;
-  bool changed_;
-  std::function<void()> enterField_;
-  std::function<void(int newValue)> changeValue_;
-  std::function<void(bool changed, int finalValue)> exitField_;
-};
+  SDL_SetRenderTarget(renderer.get(), nullptr);
+  SDL_RenderCopy(renderer.get(), canvas_.get(), &pos_, &pos_);
+  if( overlay_ )
+  {
+    renderOverlay(renderer);
+  }
+  overlayDirty_ = false;
+  return true;
+}
 
-LeverFrame::LeverFrame(
-  std::string const& framePath,
-  std::string const& fontFile,
-  SDL_Rect const& pos,
-  ServoController& servoController)
-  : framePath_(framePath)
-  , pos_(pos)
-  , leverFont_(sdl::ttf::open_font(fontFile.c_str(), 18))
+void LeverFrame::toggleOverlay()
 {
-  if( !leverFont_ )
+  overlay_ = !overlay_;
+  overlayDirty_ = true;
+}
+
+void LeverFrame::renderOverlay(sdl::renderer const& renderer)
+{
+  perf::sample(rates_);
+  auto rate = [this](perf::Counter counter)
+              {
+                return static_cast<unsigned int>(rates_.perSec_[counter]);
+              };
+  auto frames = rates_.perSec_[perf::Frames];
+  std::vector<std::pair<std::string, unsigned int>> lines{
+    { "Frames/s", rate(perf::Frames) },
+    { "Frame us", frames > 0
+      ? static_cast<unsigned int>(rates_.perSec_[perf::FrameTime] / frames / 1000)
+      : 0 },
+    { "TTF us/s", rate(perf::TextTime) / 1000 },
+    { "Textures/s", rate(perf::Textures) },
+    { "Events/s", rate(perf::Events) }
+  };
+  for( auto&& link : servoController_.stats() )
   {
-    std::string msg = "Failed to open font " + fontFile + + ": " + TTF_GetError();
-    throw std::runtime_error(msg);
+    lines.emplace_back(link.first + " bytes/s", link.second.bytesPerSec_);
+    lines.emplace_back(link.first + " age ms", link.second.age_ / 1000);
   }
 
-  loadFrame(servoController);
-
-  leverSelector_ = std::make_shared<FieldEditor>(
-    0,
+  int const margin = 4;
+  int labelWidth = 0;
+  for( auto&& line : lines )
+  {
+    labelWidth = std::max(labelWidth, glyphs_.textSize(renderer, line.first).w);
+  }
+  SDL_Rect box{
     0,
-    levers_.size() - 1,
-    std::function<void()>(),
-    std::function<void(int)>(),
-    std::function<void(bool,int)>());
-  currentField_ = leverSelector_;
+    pos_.y,
+    labelWidth + glyphs_.numberWidth(renderer, 999999) + margin * 3,
+    static_cast<int>(lines.size()) * glyphs_.lineSkip() + margin * 2};
+  box.x = pos_.x + pos_.w - box.w;
+  SDL_SetRenderDrawColor(renderer.get(), 0x00, 0x00, 0x00, 0xFF);
+  SDL_RenderFillRect(renderer.get(), &box);
+
+  auto y = box.y + margin;
+  for( auto&& line : lines )
+  {
+    glyphs_.drawText(renderer, line.first, box.x + margin, y);
+    glyphs_.drawNumber(renderer, line.second, box.x + labelWidth + margin * 2, y);
+    y += glyphs_.lineSkip();
+  }
 }
 
-LeverFrame::~LeverFrame()
+void LeverFrame::invalidate()
 {
-  saveFrame();
+  // target textures may have lost their contents so rebuild them all
+  background_.reset();
+  redrawAll_ = true;
 }
 
-void LeverFrame::render(sdl::renderer const& renderer)
+void LeverFrame::deviceReset()
 {
-  SDL_Rect framePos = pos_;
-  framePos.h = Lever::height() * 3 / 2;
-  sdl::render_set_colour(renderer, sdl::grey);
-  SDL_RenderFillRect(renderer.get(), &framePos);
+  glyphs_.clear();
+  canvas_.reset();
+  invalidate();
+}
+
+void LeverFrame::redraw()
+{
+  redrawAll_ = true;
+}
 
-  for(int i = 0; i < levers_.size(); i++)
+sdl::texture LeverFrame::createTarget(
+  sdl::renderer const& renderer,
+  int width,
+  int height)
+{
+  sdl::texture target(
+    SDL_CreateTexture(
+      renderer.get(),
+      SDL_PIXELFORMAT_RGBA8888,
+      SDL_TEXTUREACCESS_TARGET,
+      width,
+      height),
+    SDL_DestroyTexture);
+  if( !target )
   {
-    levers_[i].render(renderer, i == leverSelector_->current());
+    sdl::throw_error("Failed to create frame texture: ");
   }
+  perf::add(perf::Textures);
+  return target;
 }
 
 void LeverFrame::handleLeft()
@@ -169,6 +287,10 @@ void LeverFrame::handleUp()
 
 void LeverFrame::handleDown()
 {
+  if( levers_.empty() )
+  {
+    return;
+  }
   auto next = levers_[leverSelector_->current()].nextField();
 
   if( next )
@@ -177,46 +299,76 @@ void LeverFrame::handleDown()
   }
 }
 
-void LeverFrame::loadFrame(ServoController& servoController)
+int LeverFrame::endVisible() const
 {
-  std::ifstream is(framePath_);
-  while( is )
+  return std::min<int>(first_ + pos_.w / Lever::spacing(), levers_.size());
+}
+
+void LeverFrame::scrollToSelected()
+{
+  auto visible = std::max(pos_.w / Lever::spacing(), 1);
+  auto first = std::min(std::max(first_, selected_ - visible + 1), selected_);
+  if( first != first_ )
   {
-    std::string line;
-    std::getline(is, line);
-    if( !line.empty() && line[0] != '#' )
-    {
-      Tokeniser fields(line);
-      try
-      {
-        levers_.emplace_back(
-          servoController,
-          fields,
-          leverFont_,
-          pos_.x + levers_.size() * Lever::spacing(),
-          pos_.y + Lever::height() / 4);
-      }
-      catch(...)
-      {
-        std::cerr << "Lever "
-                  << levers_.size()
-                  << " incorrectly formatted: "
-                  << line
-                  << std::endl;
-      }
-    }
+    first_ = first;
+    layoutLevers();
+    // the background only holds the levers that are in view
+    background_.reset();
+  }
+}
+
+void LeverFrame::layoutLevers()
+{
+  for( int i = first_; i < endVisible(); i++ )
+  {
+    levers_[i].place(pos_.x + (i - first_) * Lever::spacing());
+  }
+}
+
+void LeverFrame::autosave(std::chrono::steady_clock::duration interval)
+{
+  auto now = std::chrono::steady_clock::now();
+  if( now - lastSave_ >= interval )
+  {
+    lastSave_ = now;
+    saveFrame();
+  }
+}
+
+void LeverFrame::createLevers(FrameCache const& frame, ServoController& servoController)
+{
+  levers_.reserve(frame.size());
+  for( std::size_t i = 0; i < frame.size(); i++ )
+  {
+    levers_.emplace_back(
+      servoController,
+      frame[i],
+      glyphs_,
+      pos_.y + Lever::height() / 4);
   }
 }
 
 void LeverFrame::saveFrame()
 {
-  std::ofstream os(framePath_);
-  os << "# Name,Board,servo,Type(S|P|F|-),Normal-pos,Reversed-pos,Pull-speed,"
-     << "Return-speed,Description" << std::endl;
-  for( auto&& lever : levers_)
+  // nothing is written unless a lever has been edited since the last save
+  bool modified = false;
+  for( auto&& lever : levers_ )
+  {
+    modified = lever.modified() || modified;
+  }
+  if( !modified )
+  {
+    return;
+  }
+
+  std::vector<LeverRecord> records;
+  records.reserve(levers_.size());
+  for( auto&& lever : levers_ )
   {
-    lever.write(os);
+    records.push_back(lever.record());
+    lever.markSaved();
   }
+  saver_.save(std::move(records));
 }
 
 void LeverFrame::changeField(std::shared_ptr<FieldEditor> newField)
@@ -234,15 +386,19 @@ void LeverFrame::changeField(std::shared_ptr<FieldEditor> newField)
 
 LeverFrame::Lever::Lever(
   ServoController& servoController,
-  Tokeniser& values,
-  sdl::ttf::font const& font,
-  int x,
+  LeverView const& record,
+  GlyphAtlas& glyphs,
   int y)
   : servoController_(servoController)
-  , font_(font)
+  , glyphs_(glyphs)
+  , x_(0)
+  , y_(y)
   , currField_(nullptr)
+  , dirty_(true)
+  , fieldsDirty_(true)
+  , modified_(false)
 {
-  auto fieldSpace = TTF_FontLineSkip(font.get());
+  auto fieldSpace = glyphs.lineSkip();
   auto hposBase = y
   + height() * 3 / 2 // below levers + margin
   + fieldSpace; // skip space for description
@@ -253,21 +409,17 @@ LeverFrame::Lever::Lever(
     0,
     0,
     0,
-    values.next().second);
-  fields_[0].adjustPos_ = [x,y](Field* field)
-                          {
-                              field->pos_.x = x + (spacing() - field->pos_.w) / 2;
-                              field->pos_.y = y + height() / 3;
-                          };
+    std::string(record.name_));
 
+  board_ = record.board_;
   fields_.emplace_back(
     hposBase += fieldSpace,
     Field::Integer,
     0,
     0,
-    std::stoi(values.next().second),
+    board_,
     "Board: ");
-  connector_ = std::stoi(values.next().second);
+  connector_ = record.connector_;
   fields_.emplace_back(
     hposBase += fieldSpace,
     Field::Integer,
@@ -275,15 +427,14 @@ LeverFrame::Lever::Lever(
     0,
     connector_,
     "Connector: ");
-  auto type_str = values.next().second;
-  type_ = Lever::to_type(type_str);
-  fields_.emplace_back(0, Field::Hidden, 0, 0, 0, type_str);
+  type_ = Lever::to_type(record.type_);
+  fields_.emplace_back(0, Field::Hidden, 0, 0, 0, std::string(1, record.type_));
   fields_.emplace_back(
     hposBase += fieldSpace,
     Field::Editable | Field::Integer,
     0,
     255,
-    std::stoi(values.next().second),
+    record.normalPos_,
     "Normal Position: ",
     ServoController::Normal,
     ServoController::Position);
@@ -292,7 +443,7 @@ LeverFrame::Lever::Lever(
     Field::Editable | Field::Integer,
     0,
     255,
-    std::stoi(values.next().second),
+    record.reversedPos_,
     "Reversed Position: ",
     ServoController::Reversed,
     ServoController::Position);
@@ -301,7 +452,7 @@ LeverFrame::Lever::Lever(
     Field::Editable | Field::Integer,
     0,
     6,
-    std::stoi(values.next().second),
+    record.pullSpeed_,
     "Pull Speed: ",
     ServoController::Normal,
     ServoController::Speed);
@@ -310,7 +461,7 @@ LeverFrame::Lever::Lever(
     Field::Editable | Field::Integer,
     0,
     6,
-    std::stoi(values.next().second),
+    record.returnSpeed_,
     "Return Speed: ",
     ServoController::Reversed,
     ServoController::Speed);
@@ -320,8 +471,15 @@ LeverFrame::Lever::Lever(
     0,
     0,
     0,
-    values.remainder());
+    std::string(record.description_));
+
+  place(x_);
+}
 
+void LeverFrame::Lever::place(int x)
+{
+  x_ = x;
+  auto y = y_;
   handlePos_ =
   {
     x + (spacing() / 4),
@@ -336,6 +494,13 @@ LeverFrame::Lever::Lever(
     spacing() * 3 / 4,
     height() * 2 / 3
   };
+  columnPos_ =
+  {
+    x,
+    y - height() / 4,
+    spacing(),
+    height() * 3 / 2
+  };
   auto selectHeight = height() / 12; // height()/4 is the bottom margin
   selectPos_ =
   {
@@ -346,88 +511,28 @@ LeverFrame::Lever::Lever(
   };
 }
 
-namespace
-{
-  struct FieldSep
-  {
-    bool active_;
-
-    FieldSep() : active_(false) {}
-  };
-
-  std::ostream& operator <<(std::ostream& os, FieldSep& sep)
-  {
-    if( sep.active_ )
-    {
-      os << ',';
-    }
-    else
-    {
-      sep.active_ = true;
-    }
-    return os;
-  }
-}
-
-void LeverFrame::Lever::write(std::ostream& os)
+LeverRecord LeverFrame::Lever::record() const
 {
-  FieldSep sep;
-  for(auto&& field : fields_)
-  {
-    os << sep;
-    if( (field.flags_ & Field::Integer) != 0 )
-    {
-      os << field.cur_;
-    }
-    else
-    {
-      os << field.str_;
-    }
-  }
-  os << std::endl;
+  return {
+    fields_[0].str_,
+    fields_[1].cur_,
+    fields_[2].cur_,
+    fields_[3].str_[0],
+    fields_[4].cur_,
+    fields_[5].cur_,
+    fields_[6].cur_,
+    fields_[7].cur_,
+    fields_[8].str_};
 }
 
-void LeverFrame::Lever::render(sdl::renderer const& renderer, bool selected)
+void LeverFrame::Lever::renderBody(sdl::renderer const& renderer)
 {
-  static SDL_Color const colours[] =
-  {
-    { 0xAA, 0x00, 0x00 },
-    sdl::black,
-    { 0x00, 0x00, 0xAA },
-    sdl::white
-  };
+  layoutFields(renderer);
 
-  for( auto&& field: fields_ )
-  {
-    if( (field.flags_ & Field::Hidden) == 0 && !field.texture_ )
-    {
-      std::string valStr;
-      auto& str = (field.flags_ & Field::Integer) != 0
-        ? valStr = field.str_ + std::to_string(field.cur_)
-        : field.str_;
-      auto surface = sdl::ttf::render_blended(font_, str, sdl::grey);
-      field.texture_ = sdl::create_texture_from_surface(renderer, surface);
-      sdl::ttf::size(font_, str, &field.pos_.w, &field.pos_.h);
-      if( field.adjustPos_ )
-      {
-        field.adjustPos_(&field);
-      }
-    }
-  }
-
-  sdl::render_set_colour(renderer, colours[static_cast<int>(type_)]);
+  sdl::render_set_colour(renderer, colour());
   SDL_RenderFillRect(renderer.get(), &leverPos_);
   SDL_RenderFillRect(renderer.get(), &handlePos_);
 
-  auto first = &fields_[0];
-  auto last = &fields_[1];
-
-  if( selected )
-  {
-    SDL_RenderFillRect(renderer.get(), &selectPos_);
-    last = &fields_[fields_.size()];
-  }
-
   auto& plate_pos = fields_[0].pos_;
   filledEllipseRGBA(
     renderer.get(),
@@ -449,9 +554,34 @@ void LeverFrame::Lever::render(sdl::renderer const& renderer, bool selected)
     sdl::black.g,
     sdl::black.b,
     SDL_ALPHA_OPAQUE);
+  glyphs_.drawText(renderer, fields_[0].str_, plate_pos.x, plate_pos.y);
+}
+
+void LeverFrame::Lever::render(
+  sdl::renderer const& renderer,
+  sdl::texture const& background,
+  bool selected)
+{
+  sdl::render_copy(renderer, background, &columnPos_, &columnPos_);
+
+  if( selected )
+  {
+    sdl::render_set_colour(renderer, colour());
+    SDL_RenderFillRect(renderer.get(), &selectPos_);
+  }
+  dirty_ = false;
+}
 
-  for( auto field = first; field < last; field++ )
+void LeverFrame::Lever::renderFields(sdl::renderer const& renderer)
+{
+  layoutFields(renderer);
+
+  for( auto field = &fields_[1]; field < &fields_[fields_.size()]; field++ )
   {
+    if( (field->flags_ & Field::Hidden) != 0 )
+    {
+      continue;
+    }
     if( field == currField_ )
     {
       filledTrigonRGBA(
@@ -479,8 +609,61 @@ void LeverFrame::Lever::render(sdl::renderer const& renderer, bool selected)
         sdl::white.b,
         SDL_ALPHA_OPAQUE);
     }
-    sdl::render_copy(renderer, field->texture_, nullptr, &field->pos_);
+    auto x = glyphs_.drawText(renderer, field->str_, field->pos_.x, field->pos_.y);
+    if( (field->flags_ & Field::Integer) != 0 )
+    {
+      glyphs_.drawNumber(renderer, field->cur_, x, field->pos_.y);
+    }
+  }
+  fieldsDirty_ = false;
+}
+
+bool LeverFrame::Lever::modified() const
+{
+  return modified_;
+}
+
+void LeverFrame::Lever::markSaved()
+{
+  modified_ = false;
+}
+
+bool LeverFrame::Lever::dirty() const
+{
+  return dirty_;
+}
+
+bool LeverFrame::Lever::fieldsDirty() const
+{
+  return fieldsDirty_;
+}
+
+void LeverFrame::Lever::invalidate()
+{
+  dirty_ = true;
+  fieldsDirty_ = true;
+}
+
+void LeverFrame::Lever::layoutFields(sdl::renderer const& renderer)
+{
+  for( auto&& field: fields_ )
+  {
+    if( (field.flags_ & Field::Hidden) == 0 )
+    {
+      auto& size = glyphs_.textSize(renderer, field.str_);
+      field.pos_.w = size.w;
+      field.pos_.h = size.h;
+      if( (field.flags_ & Field::Integer) != 0 )
+      {
+        field.pos_.w += glyphs_.numberWidth(renderer, field.cur_);
+      }
+    }
   }
+
+  // the name is centred on the plate on the lever
+  auto& plate = fields_[0];
+  plate.pos_.x = x_ + (spacing() - plate.pos_.w) / 2;
+  plate.pos_.y = y_ + height() / 3;
 }
 
 std::shared_ptr<FieldEditor> LeverFrame::Lever::nextField()
@@ -491,6 +674,7 @@ std::shared_ptr<FieldEditor> LeverFrame::Lever::nextField()
     if( field->flags_ & Field::Editable )
     {
       currField_ = field;
+      fieldsDirty_ = true;
       return makeFieldEditor(field);
     }
   }
@@ -505,24 +689,39 @@ std::shared_ptr<FieldEditor> LeverFrame::Lever::prevField()
     if( field->flags_ & Field::Editable )
     {
       currField_ = field;
+      fieldsDirty_ = true;
       return makeFieldEditor(field);
     }
   }
   currField_ = nullptr;
+  fieldsDirty_ = true;
   return {};
 }
 
-LeverFrame::Lever::Type LeverFrame::Lever::to_type(std::string const& str)
+LeverFrame::Lever::Type LeverFrame::Lever::to_type(char c)
 {
-  static std::map<std::string,Type> const types =
+  static std::map<char,Type> const types =
   {
-    { "S", Type::Signal },
-    { "P", Type::Point },
-    { "F", Type::FPL },
-    { "-", Type::Spare }
+    { 'S', Type::Signal },
+    { 'P', Type::Point },
+    { 'F', Type::FPL },
+    { '-', Type::Spare }
+  };
+
+  return types.at(c);
+}
+
+SDL_Color const& LeverFrame::Lever::colour() const
+{
+  static SDL_Color const colours[] =
+  {
+    { 0xAA, 0x00, 0x00 },
+    sdl::black,
+    { 0x00, 0x00, 0xAA },
+    sdl::white
   };
 
-  return types.at(str);
+  return colours[static_cast<int>(type_)];
 }
 
 int LeverFrame::Lever::spacing()
@@ -543,7 +742,8 @@ std::shared_ptr<FieldEditor> LeverFrame::Lever::makeFieldEditor(Field* field)
     field->max_,
     [this,field]()
     {
-      servoController_.start(connector_,
+      servoController_.start(board_,
+                             connector_,
                              field->direction_,
                              field->function_,
                              field->cur_);
@@ -551,7 +751,8 @@ std::shared_ptr<FieldEditor> LeverFrame::Lever::makeFieldEditor(Field* field)
     [this,field](int newValue)
     {
       field->cur_ = newValue;
-      field->texture_.reset();
+      fieldsDirty_ = true;
+      modified_ = true;
       servoController_.update(newValue);
     },
     [this](bool, int)
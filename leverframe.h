@@ -4,24 +4,57 @@
 #include "sdl2-cpp/sdl2.h"
 #include "sdl2-cpp/ttf.h"
 
+#include <chrono>
 #include <functional>
 #include <vector>
 
+#include "glyphatlas.h"
+#include "autosaver.h"
+#include "framecache.h"
+#include "framefile.h"
+#include "perf.h"
 #include "servocontroller.h"
-#include "tokeniser.h"
 
 class FieldEditor;
 
 class LeverFrame
 {
 public:
+  // frame holds the frame file's levers, already loaded from framePath
   LeverFrame(std::string const& framePath,
+             FrameCache const& frame,
              std::string const& fontFile,
              SDL_Rect const& pos,
              ServoController& servoController);
   ~LeverFrame();
 
-  void render(sdl::renderer const& renderer);
+  // True if the next render will draw anything
+  bool dirty() const;
+
+  // Applies any pending edits and brings the frame on screen up to date,
+  // returns false without drawing anything if nothing has changed since
+  // the last call, or if the frame has no levers.
+  bool render(sdl::renderer const& renderer);
+
+  // Forces the whole frame, including the parts that never change, to be
+  // redrawn on the next render, for when the renderer's target textures
+  // have lost their contents
+  void invalidate();
+
+  // As invalidate(), for when the renderer's device has been lost and
+  // every texture with it, so that they are all created again
+  void deviceReset();
+
+  // Forces the whole frame to be redrawn on the next render from the
+  // parts that never change, which are kept
+  void redraw();
+
+  // Shows or hides live performance figures over the top right of the frame
+  void toggleOverlay();
+
+  // Saves any edits in the background if interval has passed since the
+  // last save
+  void autosave(std::chrono::steady_clock::duration interval);
 
   void handleLeft();
   void handleRight();
@@ -29,11 +62,22 @@ public:
   void handleDown();
 
 private:
-  void loadFrame(ServoController& servoController);
+  void createLevers(FrameCache const& frame, ServoController& servoController);
   void saveFrame();
 
   void changeField(std::shared_ptr<FieldEditor> newField);
 
+  // only the levers that fit on screen, from first_, are laid out and drawn
+  int endVisible() const;
+  void scrollToSelected();
+  void layoutLevers();
+  void renderOverlay(sdl::renderer const& renderer);
+
+  static sdl::texture createTarget(
+    sdl::renderer const& renderer,
+    int width,
+    int height);
+
   class Lever
   {
   public:
@@ -48,19 +92,37 @@ private:
   public:
     Lever(
       ServoController& servoController,
-      Tokeniser& values,
-      sdl::ttf::font const& font,
-      int x,
+      LeverView const& record,
+      GlyphAtlas& glyphs,
       int y);
 
-    void write(std::ostream& os);
+    // positions the lever in the frame with its left edge at x
+    void place(int x);
+
+    LeverRecord record() const;
+    bool modified() const;
+    void markSaved();
 
-    void render(sdl::renderer const& renderer, bool selected);
+    // draws the parts of the lever that never change
+    void renderBody(sdl::renderer const& renderer);
+    // redraws the lever's column of the frame from the background
+    void render(
+      sdl::renderer const& renderer,
+      sdl::texture const& background,
+      bool selected);
+    // draws the lever's fields below the frame
+    void renderFields(sdl::renderer const& renderer);
+
+    bool dirty() const;
+    bool fieldsDirty() const;
+    void invalidate();
 
     std::shared_ptr<FieldEditor> nextField();
     std::shared_ptr<FieldEditor> prevField();
 
-    static Type to_type(std::string const& str);
+    SDL_Color const& colour() const;
+
+    static Type to_type(char c);
     static int spacing();
     static int height();
 
@@ -91,7 +153,6 @@ private:
         , max_(max)
         , cur_(cur)
         , str_(std::move(str))
-        , texture_(nullptr, nullptr)
       {
         pos_.x = 40;
         pos_.y = hpos;
@@ -104,27 +165,45 @@ private:
       int max_;
       int cur_;
       std::string str_;
-      sdl::texture texture_;
       SDL_Rect pos_;
-      std::function<void(Field*)> adjustPos_;
     };
     std::shared_ptr<FieldEditor> makeFieldEditor(Field* field);
+    void layoutFields(sdl::renderer const& renderer);
 
     ServoController& servoController_;
-    sdl::ttf::font const& font_;
+    GlyphAtlas& glyphs_;
+    int x_;
+    int y_;
+    SDL_Rect columnPos_;
     SDL_Rect handlePos_;
     SDL_Rect leverPos_;
     SDL_Rect selectPos_;
     Type type_;
+    int board_;
     int connector_;
     std::vector<Field> fields_;
     Field* currField_;
+    bool dirty_;
+    bool fieldsDirty_;
+    bool modified_;
   };
 
   std::string framePath_;
   SDL_Rect pos_;
   sdl::ttf::font leverFont_;
+  GlyphAtlas glyphs_;
   std::vector<Lever> levers_;
+  sdl::texture canvas_;
+  sdl::texture background_;
+  AutoSaver saver_;
+  std::chrono::steady_clock::time_point lastSave_;
+  int first_;
+  bool redrawAll_;
+  int selected_;
   std::shared_ptr<FieldEditor> leverSelector_;
   std::shared_ptr<FieldEditor> currentField_;
+  ServoController& servoController_;
+  bool overlay_;
+  bool overlayDirty_;
+  perf::Rates rates_;
 };
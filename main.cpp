@@ -9,11 +9,97 @@
 #include "sdl2-cpp/sdl2.h"
 #include "sdl2-cpp/ttf.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
 #include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
 #include <stdexcept>
+#include <sys/stat.h>
+#include <utility>
+#include <vector>
 
+#include "controlserver.h"
+#include "framecache.h"
+#include "framefile.h"
+#include "headless.h"
+#include "latency.h"
 #include "leverframe.h"
+#include "packettrace.h"
+#include "perf.h"
 #include "servocontroller.h"
+#include "spscring.h"
+
+namespace
+{
+  std::atomic<bool> latencyDumpRequested(false);
+
+  void requestLatencyDump(int)
+  {
+    latencyDumpRequested = true;
+  }
+
+  // When each step of startup finished, the steps run on several threads
+  class StartupTimeline
+  {
+  public:
+    StartupTimeline()
+      : start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    void mark(std::string const& step)
+    {
+      auto now = std::chrono::steady_clock::now();
+      std::lock_guard<std::mutex> lock(guard_);
+      steps_.emplace_back(now, step);
+    }
+
+    void write(std::ostream& os)
+    {
+      std::lock_guard<std::mutex> lock(guard_);
+      std::sort(steps_.begin(), steps_.end());
+      for( auto&& step : steps_ )
+      {
+        os << std::fixed << std::setprecision(1) << std::setw(8)
+           << std::chrono::duration<double, std::milli>(step.first - start_).count()
+           << "ms " << step.second << std::endl;
+      }
+    }
+
+  private:
+    std::chrono::steady_clock::time_point start_;
+    std::mutex guard_;
+    std::vector<std::pair<std::chrono::steady_clock::time_point, std::string>> steps_;
+  };
+
+  // holds the font name and the file fontconfig matched it to
+  std::string fontCachePath()
+  {
+    std::string dir;
+    if( auto cache = std::getenv("XDG_CACHE_HOME") )
+    {
+      dir = cache;
+    }
+    else if( auto home = std::getenv("HOME") )
+    {
+      dir = std::string(home) + "/.cache";
+    }
+    else
+    {
+      return {};
+    }
+    mkdir(dir.c_str(), 0755);
+    dir += "/rpi-servoset";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/font";
+  }
+}
 
 std::string GetFontFile(std::string const& fontName)
 {
@@ -38,12 +124,49 @@ std::string GetFontFile(std::string const& fontName)
   return fontFile;
 }
 
+// As GetFontFile but only asks fontconfig, which is slow to start, if
+// the file found last time has gone.
+std::string FindFontFile(std::string const& fontName)
+{
+  auto cachePath = fontCachePath();
+  std::ifstream is(cachePath);
+  std::string cachedName;
+  std::string cachedFile;
+  struct stat st;
+  if( std::getline(is, cachedName) &&
+      std::getline(is, cachedFile) &&
+      cachedName == fontName &&
+      stat(cachedFile.c_str(), &st) == 0 )
+  {
+    return cachedFile;
+  }
+
+  auto fontFile = GetFontFile(fontName);
+  if( !fontFile.empty() && !cachePath.empty() )
+  {
+    std::ofstream os(cachePath, std::ios::trunc);
+    os << fontName << "\n" << fontFile << "\n";
+  }
+  return fontFile;
+}
+
 int main(int argc, char** argv)
 {
+  StartupTimeline timeline;
   std::string frameFileName;
   std::string buttonFileName;
   std::string serialPort;
+  std::string boardFileName;
+  unsigned int baudRate = 9600;
+  bool linkStats = false;
+  bool latencyStats = false;
   bool fullScreen = false;
+  unsigned int maxFps = 0;
+  unsigned int autosaveInterval = 30;
+  bool startupStats = false;
+  std::string controlSocket;
+  std::string recordFileName;
+  std::string headlessMode;
 
   if( !Opt::parseCmdLine(argc, argv, {
         Opt(
@@ -63,35 +186,178 @@ int main(int argc, char** argv)
           }),
         Opt(
           "--serialPort=(.+)",
-          "Name of serial port to write to",
+          "Name of serial port to write to for boards not in the board file",
           [&serialPort](std::cmatch const& m)
           {
             serialPort = m[1];
           }),
+        Opt(
+          "--boardFile=(.+)",
+          "Name of file mapping board numbers to serial ports",
+          [&boardFileName](std::cmatch const& m)
+          {
+            boardFileName = m[1];
+          }),
+        Opt(
+          "--baudRate=([0-9]+)",
+          "Baud rate for boards without one in the board file (default 9600)",
+          [&baudRate](std::cmatch const& m)
+          {
+            baudRate = std::stoi(m[1]);
+          }),
+        Opt(
+          "--linkStats",
+          "Report serial link statistics on exit",
+          [&linkStats](std::cmatch const& m)
+          {
+            linkStats = true;
+          }),
+        Opt(
+          "--latencyStats",
+          "Report input to serial write latency on exit, or on SIGUSR1",
+          [&latencyStats](std::cmatch const& m)
+          {
+            latencyStats = true;
+          }),
         Opt(
           "--fullScreen",
           "Use full screen window",
           [&fullScreen](std::cmatch const& m)
           {
             fullScreen = true;
+          }),
+        Opt(
+          "--maxFps=([1-9][0-9]*)",
+          "Maximum frames drawn per second (default display refresh rate)",
+          [&maxFps](std::cmatch const& m)
+          {
+            maxFps = std::stoi(m[1]);
+          }),
+        Opt(
+          "--autosave=([0-9]+)",
+          "Seconds between saves of frame file edits, 0 to only save on exit (default 30)",
+          [&autosaveInterval](std::cmatch const& m)
+          {
+            autosaveInterval = std::stoi(m[1]);
+          }),
+        Opt(
+          "--controlSocket=(.+)",
+          "UNIX domain socket to accept servo commands from other programs on",
+          [&controlSocket](std::cmatch const& m)
+          {
+            controlSocket = m[1];
+          }),
+        Opt(
+          "--recordFile=(.+)",
+          "Record every packet written to the boards in this trace file",
+          [&recordFileName](std::cmatch const& m)
+          {
+            recordFileName = m[1];
+          }),
+        Opt(
+          "--startupStats",
+          "Report when each step of startup finished, up to the first frame",
+          [&startupStats](std::cmatch const& m)
+          {
+            startupStats = true;
+          }),
+        Opt(
+          "--headless=(apply|verify)",
+          "Apply every lever's settings to the boards, or verify them, then exit",
+          [&headlessMode](std::cmatch const& m)
+          {
+            headlessMode = m[1];
           })}) )
   {
     return 1;
   }
 
+  if( !headlessMode.empty() )
+  {
+    try
+    {
+      if( headlessMode == "verify" )
+      {
+        return headless::verify(frameFileName, std::cout);
+      }
+      std::unique_ptr<PacketRecorder> recorder;
+      if( !recordFileName.empty() )
+      {
+        recorder.reset(new PacketRecorder(recordFileName));
+      }
+      ServoController servoController(serialPort, baudRate, boardFileName, recorder.get());
+      auto status = headless::apply(frameFileName, servoController, std::cout);
+      if( linkStats )
+      {
+        servoController.writeStats(std::cout);
+      }
+      return status;
+    }
+    catch(std::exception const& e)
+    {
+      std::cerr << "An exception occurred: " << e.what() << std::endl;
+      return 2;
+    }
+  }
+
   try
   {
+    std::unique_ptr<PacketRecorder> recorder;
+    if( !recordFileName.empty() )
+    {
+      recorder.reset(new PacketRecorder(recordFileName));
+    }
+
+    // none of these need SDL or each other so they run while SDL starts
+    auto fontReady = std::async(
+      std::launch::async,
+      [&timeline]()
+      {
+        auto fontFile = FindFontFile("DejaVuSans");
+        timeline.mark("font found");
+        return fontFile;
+      });
+    auto frameReady = std::async(
+      std::launch::async,
+      [&timeline, &frameFileName]()
+      {
+        auto frame = FrameCache::load(
+          frameFileName,
+          [&frameFileName](FrameError const& e)
+          {
+            std::cerr << frameFileName << ":" << e.what() << std::endl;
+          });
+        timeline.mark("frame loaded");
+        return frame;
+      });
+    auto serialReady = std::async(
+      std::launch::async,
+      [&]()
+      {
+        auto controller = std::make_unique<ServoController>(
+          serialPort,
+          baudRate,
+          boardFileName,
+          recorder.get());
+        timeline.mark("serial ports open");
+        return controller;
+      });
+
     auto sdlLib = sdl::init();
     auto ttfLib = sdl::ttf::init();
+    timeline.mark("SDL initialised");
 
     auto buttonPressEventType = SDL_RegisterEvents(1);
     if( buttonPressEventType == static_cast<Uint32>(-1) )
     {
       sdl::throw_error("Failed to register event types with SDL: ");
     }
+    // time each button was pressed, in the same order as the events
+    SpscRing<latency::Clock::time_point, 64> buttonTimes;
     gpiosysfs::Buttons buttons(
-      [&buttonPressEventType](std::string const& function)
+      [&buttonPressEventType, &buttonTimes](std::string const& function)
       {
+        auto pressed = latency::Clock::now();
         static std::map<std::string, SDL_Keycode> const buttonMap{
           {"blue", SDLK_LEFT},
           {"green", SDLK_RIGHT},
@@ -104,6 +370,7 @@ int main(int argc, char** argv)
         {
           SDL_Event event;
           event.type = buttonPressEventType;
+          event.user.code = buttonTimes.push(pressed) ? 1 : 0;
           event.key.keysym.sym = static_cast<Sint32>(a->second);
           SDL_PushEvent(&event);
         }
@@ -138,20 +405,32 @@ int main(int argc, char** argv)
     SDL_Rect displayBounds{0, 0, 0, 0};
     SDL_GetWindowSize(window.get(), &displayBounds.w, &displayBounds.h);
 
-    auto renderer = sdl::create_renderer(window, -1, SDL_RENDERER_ACCELERATED);
+    auto renderer = sdl::create_renderer(
+      window,
+      -1,
+      SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE | SDL_RENDERER_PRESENTVSYNC);
     if( !renderer )
     {
       sdl::throw_error("Failed to create SDL renderer: ");
     }
 
-    std::string fontFileName = GetFontFile("DejaVuSans");
+    timeline.mark("renderer created");
 
-    ServoController servoController(serialPort);
+    auto controller = serialReady.get();
+    auto& servoController = *controller;
+    auto frame = frameReady.get();
+    std::unique_ptr<ControlServer> controlServer;
+    if( !controlSocket.empty() )
+    {
+      controlServer.reset(new ControlServer(controlSocket, frame, servoController));
+    }
     LeverFrame leverFrame(
       frameFileName,
-      fontFileName,
+      frame,
+      fontReady.get(),
       displayBounds,
       servoController);
+    timeline.mark("lever frame created");
 
     bool quit = false;
     std::map<SDL_Keycode, std::function<void()>> keys{
@@ -159,32 +438,134 @@ int main(int argc, char** argv)
       {SDLK_RIGHT, [&leverFrame](){leverFrame.handleRight();}},
       {SDLK_UP, [&leverFrame](){leverFrame.handleUp();}},
       {SDLK_DOWN, [&leverFrame](){leverFrame.handleDown();}},
+      {SDLK_p, [&leverFrame](){leverFrame.toggleOverlay();}},
       {SDLK_q, [&quit](){quit = true;}}
     };
 
-    SDL_Event e;
-    while( !quit && SDL_WaitEvent( &e ) != 0 )
-    {
-      SDL_SetRenderDrawColor(renderer.get(), 0x00, 0x00, 0x00, 0xFF);
-      SDL_RenderClear(renderer.get());
+    std::signal(SIGUSR1, requestLatencyDump);
 
+    auto handleEvent = [&](SDL_Event const& e)
+    {
+      perf::add(perf::Events);
+      // holding left or right repeats, and accelerates, the step
+      bool isRepeat =
+        e.type == SDL_KEYDOWN &&
+        e.key.repeat != 0 &&
+        (e.key.keysym.sym == SDLK_LEFT || e.key.keysym.sym == SDLK_RIGHT);
       if( sdl::is_debounced_key(e) ||
+          isRepeat ||
           e.type == buttonPressEventType)
       {
+        auto origin = latency::Clock::now();
+        if( e.type == buttonPressEventType )
+        {
+          if( e.user.code == 0 || !buttonTimes.pop(origin) )
+          {
+            origin = {};
+          }
+        }
+        else
+        {
+          // SDL only stamps keyboard events to the millisecond
+          origin -= std::chrono::milliseconds(SDL_GetTicks() - e.key.timestamp);
+        }
+        latency::begin(origin);
+        latency::record(latency::Dispatch);
+
         auto k = keys.find(e.key.keysym.sym);
         if( k != keys.end() )
         {
           k->second();
         }
+        latency::begin({});
       }
       else if( e.type == SDL_QUIT )
       {
         std::cout << "got SDL_QUIT" << std::endl;
         quit = true;
       }
+      else if( e.type == SDL_RENDER_TARGETS_RESET )
+      {
+        leverFrame.invalidate();
+      }
+      else if( e.type == SDL_RENDER_DEVICE_RESET )
+      {
+        leverFrame.deviceReset();
+      }
+      else if( e.type == SDL_WINDOWEVENT &&
+               (e.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) )
+      {
+        // the window's contents are lost but the textures are not
+        leverFrame.redraw();
+      }
+    };
+
+    if( maxFps == 0 )
+    {
+      SDL_DisplayMode mode;
+      maxFps =
+        SDL_GetDesktopDisplayMode(SDL_GetWindowDisplayIndex(window.get()), &mode) == 0 &&
+        mode.refresh_rate > 0
+        ? mode.refresh_rate
+        : 60;
+    }
+    Uint32 const frameInterval = 1000 / maxFps;
+    Uint32 lastFrame = SDL_GetTicks() - frameInterval;
+
+    SDL_Event e;
+    while( !quit )
+    {
+      if( latencyDumpRequested.exchange(false) )
+      {
+        latency::write(std::cout);
+      }
+      if( autosaveInterval > 0 )
+      {
+        leverFrame.autosave(std::chrono::seconds(autosaveInterval));
+      }
 
-      leverFrame.render(renderer);
-      SDL_RenderPresent(renderer.get());
+      // sleep until something happens unless there is a frame waiting to be
+      // drawn, but wake periodically to notice signals
+      int timeout = 500;
+      if( leverFrame.dirty() )
+      {
+        auto sinceFrame = SDL_GetTicks() - lastFrame;
+        timeout = sinceFrame < frameInterval ? frameInterval - sinceFrame : 0;
+      }
+
+      // apply everything that has arrived before drawing anything
+      if( SDL_WaitEventTimeout(&e, timeout) != 0 )
+      {
+        handleEvent(e);
+        while( !quit && SDL_PollEvent(&e) != 0 )
+        {
+          handleEvent(e);
+        }
+      }
+
+      if( !quit &&
+          SDL_GetTicks() - lastFrame >= frameInterval &&
+          leverFrame.render(renderer) )
+      {
+        SDL_RenderPresent(renderer.get());
+        lastFrame = SDL_GetTicks();
+        if( startupStats )
+        {
+          timeline.mark("first frame");
+          timeline.write(std::cout);
+          startupStats = false;
+        }
+      }
+    }
+
+    if( linkStats )
+    {
+      servoController.writeStats(std::cout);
+    }
+    if( latencyStats )
+    {
+      latency::write(std::cout);
     }
   }
   catch(std::exception const& e)
@@ -0,0 +1,179 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "packettrace.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+  char const magic[4] = { 'S', 'V', 'P', 'T' };
+  uint32_t const version = 1;
+
+  struct Header
+  {
+    char magic_[4];
+    uint32_t version_;
+  };
+
+  // followed by size bytes of packet
+  struct Record
+  {
+    uint64_t time_; // nanoseconds
+    uint16_t link_;
+    uint16_t size_;
+    uint32_t reserved_;
+  };
+
+  // pending records are written at least this often
+  auto const writeInterval = 100ms;
+
+  bool writeAll(int fd, char const* data, std::size_t size)
+  {
+    while( size > 0 )
+    {
+      auto written = write(fd, data, size);
+      if( written < 0 && errno != EINTR )
+      {
+        return false;
+      }
+      if( written > 0 )
+      {
+        data += written;
+        size -= written;
+      }
+    }
+    return true;
+  }
+}
+
+std::vector<packettrace::Packet> packettrace::load(std::string const& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if( fd < 0 )
+  {
+    throw std::runtime_error(path + ": " + std::strerror(errno));
+  }
+  std::vector<char> buf;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  if( ok )
+  {
+    buf.resize(st.st_size);
+    ok = read(fd, buf.data(), buf.size()) == static_cast<ssize_t>(buf.size());
+  }
+  close(fd);
+
+  Header header{};
+  if( ok && buf.size() >= sizeof(header) )
+  {
+    std::memcpy(&header, buf.data(), sizeof(header));
+  }
+  if( !ok ||
+      std::memcmp(header.magic_, magic, sizeof(magic)) != 0 ||
+      header.version_ != version )
+  {
+    throw std::runtime_error(path + ": not a packet trace");
+  }
+
+  std::vector<Packet> packets;
+  std::size_t pos = sizeof(header);
+  while( pos + sizeof(Record) <= buf.size() )
+  {
+    Record record;
+    std::memcpy(&record, &buf[pos], sizeof(record));
+    pos += sizeof(record);
+    if( pos + record.size_ > buf.size() )
+    {
+      // the recorder was stopped part way through a write
+      break;
+    }
+    packets.push_back(Packet{
+        std::chrono::nanoseconds(record.time_),
+        record.link_,
+        std::string(&buf[pos], record.size_)});
+    pos += record.size_;
+  }
+  return packets;
+}
+
+PacketRecorder::PacketRecorder(std::string const& path)
+  : fd_(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+  , start_(std::chrono::steady_clock::now())
+  , quit_(false)
+{
+  if( fd_ < 0 )
+  {
+    throw std::runtime_error(path + ": " + std::strerror(errno));
+  }
+  Header header;
+  std::memcpy(header.magic_, magic, sizeof(magic));
+  header.version_ = version;
+  if( !writeAll(fd_, reinterpret_cast<char const*>(&header), sizeof(header)) )
+  {
+    auto error = path + ": " + std::strerror(errno);
+    close(fd_);
+    throw std::runtime_error(error);
+  }
+  thread_ = std::thread([this]{ run(); });
+}
+
+PacketRecorder::~PacketRecorder()
+{
+  {
+    std::lock_guard<std::mutex> lock(guard_);
+    quit_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+  close(fd_);
+}
+
+void PacketRecorder::record(unsigned int link, char const* data, std::size_t size)
+{
+  // stamped under the lock so that times never go backwards in the file
+  std::lock_guard<std::mutex> lock(guard_);
+  Record record{
+    static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count()),
+    static_cast<uint16_t>(link),
+    static_cast<uint16_t>(size),
+    0};
+  auto r = reinterpret_cast<char const*>(&record);
+  pending_.insert(pending_.end(), r, r + sizeof(record));
+  pending_.insert(pending_.end(), data, data + size);
+}
+
+void PacketRecorder::run()
+{
+  std::vector<char> writing;
+  std::unique_lock<std::mutex> lock(guard_);
+  for(;;)
+  {
+    cv_.wait_for(lock, writeInterval, [this]{ return quit_; });
+    auto quit = quit_;
+    writing.swap(pending_);
+
+    lock.unlock();
+    if( !writing.empty() && !writeAll(fd_, writing.data(), writing.size()) )
+    {
+      std::cerr << "Failed to write packet trace: " << std::strerror(errno) << std::endl;
+    }
+    writing.clear();
+    if( quit )
+    {
+      return;
+    }
+    lock.lock();
+  }
+}
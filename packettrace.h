@@ -0,0 +1,58 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined PACKETTRACE_H
+#define PACKETTRACE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Binary trace of the packets written to the boards. The file starts with
+// "SVPT" and a version, then each packet is a record of the nanoseconds
+// since the trace started, the link it went to and its bytes, all in
+// native byte order.
+namespace packettrace
+{
+  // link number for the link serving boards not in the board file
+  unsigned int const defaultLink = 0xffff;
+
+  struct Packet
+  {
+    std::chrono::nanoseconds time_;
+    unsigned int link_;
+    std::string bytes_;
+  };
+
+  // throws if path can't be read or isn't a trace
+  std::vector<Packet> load(std::string const& path);
+}
+
+// Records packets from any number of link threads. Records are gathered
+// in memory and written to the file on a background thread so that the
+// links never wait for the disk.
+class PacketRecorder
+{
+public:
+  PacketRecorder(std::string const& path);
+  // writes anything still pending
+  ~PacketRecorder();
+
+  void record(unsigned int link, char const* data, std::size_t size);
+
+private:
+  void run();
+
+  int fd_;
+  std::chrono::steady_clock::time_point start_;
+  std::mutex guard_;
+  std::condition_variable cv_;
+  std::vector<char> pending_;
+  bool quit_;
+  std::thread thread_;
+};
+
+#endif // !defined PACKETTRACE_H
@@ -0,0 +1,46 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "perf.h"
+
+#include <atomic>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+  std::atomic<unsigned long long> counters[perf::CounterCount];
+
+  // as of the last sample, only touched by the UI thread
+  unsigned long long sampled[perf::CounterCount];
+  auto sampledAt = std::chrono::steady_clock::now();
+}
+
+void perf::add(Counter counter, unsigned long long amount)
+{
+  counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+bool perf::sampleDue()
+{
+  return std::chrono::steady_clock::now() - sampledAt >= 1s;
+}
+
+bool perf::sample(Rates& rates)
+{
+  auto now = std::chrono::steady_clock::now();
+  if( now - sampledAt < 1s )
+  {
+    return false;
+  }
+
+  auto seconds = std::chrono::duration<double>(now - sampledAt).count();
+  for( int i = 0; i < CounterCount; i++ )
+  {
+    auto count = counters[i].load(std::memory_order_relaxed);
+    rates.perSec_[i] = (count - sampled[i]) / seconds;
+    sampled[i] = count;
+  }
+  sampledAt = now;
+  return true;
+}
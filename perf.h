@@ -0,0 +1,60 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined PERF_H
+#define PERF_H
+
+#include <chrono>
+
+// Counters behind the on-screen performance overlay. Counting is a relaxed
+// atomic add, cheap enough to leave running, and may be done from any
+// thread.
+namespace perf
+{
+  enum Counter
+  {
+    Frames,    // frames drawn by LeverFrame::render
+    FrameTime, // ns spent drawing them
+    TextTime,  // ns spent rasterising text with TTF
+    Textures,  // textures created
+    Events,    // SDL events handled
+    CounterCount
+  };
+
+  void add(Counter counter, unsigned long long amount = 1);
+
+  // adds the ns from construction to destruction to a counter
+  class Timer
+  {
+  public:
+    explicit Timer(Counter counter)
+      : counter_(counter)
+      , start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~Timer()
+    {
+      add(counter_, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count());
+    }
+
+  private:
+    Counter counter_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  // how much each counter went up by per second
+  struct Rates
+  {
+    double perSec_[CounterCount];
+  };
+
+  // Sampling is for the UI thread only. sample() returns false until a
+  // second has passed since the last sample, then fills in the rates over
+  // that time.
+  bool sampleDue();
+  bool sample(Rates& rates);
+}
+
+#endif // !defined PERF_H
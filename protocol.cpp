@@ -0,0 +1,32 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "protocol.h"
+
+#include "servo4.h"
+
+Protocol const protocol::servo4 =
+{
+  "servo4",
+  ::servo4::packetSize,
+  ::servo4::store,
+  &::servo4::command,
+  &::servo4::encode
+};
+
+Protocol const* protocol::find(std::string_view name)
+{
+  static Protocol const* const protocols[] =
+  {
+    &servo4
+  };
+
+  for( auto p : protocols )
+  {
+    if( name == p->name_ )
+    {
+      return p;
+    }
+  }
+  return nullptr;
+}
@@ -0,0 +1,35 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <string_view>
+
+// How commands are laid out on the wire for one type of board. Each link
+// is handed the protocol for its board, other boards plug in by adding a
+// table of their own beside servo4's.
+struct Protocol
+{
+  char const* name_;
+  std::size_t packetSize_;
+  unsigned int store_; // command to store the current settings
+  // direction and function as ServoController's enums
+  unsigned int (*command_)(
+    unsigned int connection,
+    unsigned int direction,
+    unsigned int function);
+  // writes packetSize_ bytes at out
+  void (*encode_)(unsigned int cmd, unsigned int value, char* out);
+};
+
+namespace protocol
+{
+  extern Protocol const servo4;
+
+  // nullptr if there is no protocol called name
+  Protocol const* find(std::string_view name);
+}
+
+#endif // !defined PROTOCOL_H
@@ -0,0 +1,317 @@
+// Draws a lever frame with SDL's software renderer, without a display,
+// stepping through a script of selections and edits. Prints the time taken
+// to draw each kind of frame, one JSON object per line, and can check the
+// frames against golden PNGs.
+//
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include <opt-parse/opt-parse.h>
+#include "sdl2-cpp/sdl2.h"
+#include "sdl2-cpp/ttf.h"
+#include <SDL2/SDL_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "framecache.h"
+#include "framefile.h"
+#include "leverframe.h"
+#include "servocontroller.h"
+
+namespace
+{
+  int const width = 640;
+  int const height = 480;
+
+  struct Step
+  {
+    std::string name_;
+    std::function<void(LeverFrame&)> action_;
+  };
+
+  // Walks along the levers, edits the first two fields of one, goes back
+  // to the levers and forces a full redraw, as after an expose. Every step changes what is on
+  // screen so every frame draws.
+  std::vector<Step> script()
+  {
+    std::vector<Step> steps;
+    auto add = [&steps](int count, char const* name, void (LeverFrame::*action)())
+    {
+      for( int i = 0; i < count; i++ )
+      {
+        steps.push_back(Step{name, [action](LeverFrame& frame){ (frame.*action)(); }});
+      }
+    };
+    add(8, "select", &LeverFrame::handleRight);
+    add(1, "field", &LeverFrame::handleDown);
+    add(6, "edit", &LeverFrame::handleRight);
+    add(3, "edit", &LeverFrame::handleLeft);
+    add(1, "field", &LeverFrame::handleDown);
+    add(2, "edit", &LeverFrame::handleRight);
+    add(2, "field", &LeverFrame::handleUp);
+    add(1, "redraw", &LeverFrame::redraw);
+    add(4, "select", &LeverFrame::handleLeft);
+    return steps;
+  }
+
+  struct Timings
+  {
+    std::vector<long long> ns_;
+    unsigned long skipped_ = 0; // frames render() had nothing to draw for
+  };
+
+  void report(std::string const& name, std::size_t levers, Timings& timings)
+  {
+    auto& ns = timings.ns_;
+    if( ns.empty() )
+    {
+      return;
+    }
+    std::sort(ns.begin(), ns.end());
+    long long total = 0;
+    for( auto t : ns )
+    {
+      total += t;
+    }
+    auto percentile = [&ns](std::size_t p)
+    {
+      return ns[std::min(ns.size() - 1, ns.size() * p / 100)];
+    };
+    std::cout << "{\"benchmark\":\"render_" << name << "\""
+              << ",\"size\":" << levers
+              << ",\"frames\":" << ns.size()
+              << ",\"skipped\":" << timings.skipped_
+              << ",\"ns_mean\":" << total / static_cast<long long>(ns.size())
+              << ",\"ns_p50\":" << percentile(50)
+              << ",\"ns_p99\":" << percentile(99)
+              << ",\"ns_max\":" << ns.back()
+              << "}" << std::endl;
+  }
+
+  // Pixels that differ between what was drawn, in ARGB8888, and the golden
+  // image, or -1 if the golden image is missing or a different size
+  long comparePixels(SDL_Surface* drawn, std::string const& goldenFile)
+  {
+    sdl::surface loaded(IMG_Load(goldenFile.c_str()), SDL_FreeSurface);
+    if( !loaded )
+    {
+      std::cerr << goldenFile << ": " << IMG_GetError() << std::endl;
+      return -1;
+    }
+    sdl::surface golden(
+      SDL_ConvertSurfaceFormat(loaded.get(), SDL_PIXELFORMAT_ARGB8888, 0),
+      SDL_FreeSurface);
+    if( !golden || golden->w != drawn->w || golden->h != drawn->h )
+    {
+      return -1;
+    }
+
+    SDL_LockSurface(drawn);
+    SDL_LockSurface(golden.get());
+    long differing = 0;
+    for( int y = 0; y < drawn->h; y++ )
+    {
+      auto a = static_cast<Uint32 const*>(drawn->pixels) + y * drawn->pitch / 4;
+      auto b = static_cast<Uint32 const*>(golden->pixels) + y * golden->pitch / 4;
+      for( int x = 0; x < drawn->w; x++ )
+      {
+        // the alpha channel never reaches the screen
+        if( ((a[x] ^ b[x]) & 0x00FFFFFF) != 0 )
+        {
+          differing++;
+        }
+      }
+    }
+    SDL_UnlockSurface(golden.get());
+    SDL_UnlockSurface(drawn);
+    return differing;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::string frameFileName;
+  std::string fontFileName;
+  std::string goldenDir;
+  bool updateGolden = false;
+  unsigned long frames = 1000;
+
+  if( !Opt::parseCmdLine(argc, argv, {
+        Opt(
+          "--frameFile=(.+)",
+          "Frame to draw, it is not changed by the edits",
+          [&frameFileName](std::cmatch const& m)
+          {
+            frameFileName = m[1];
+          },
+          true),
+        Opt(
+          "--fontFile=(.+)",
+          "Font to draw the levers with, golden images are only valid for one font",
+          [&fontFileName](std::cmatch const& m)
+          {
+            fontFileName = m[1];
+          },
+          true),
+        Opt(
+          "--frames=([0-9]+)",
+          "Number of frames to time (default 1000)",
+          [&frames](std::cmatch const& m)
+          {
+            frames = std::stoul(m[1]);
+          }),
+        Opt(
+          "--goldenDir=(.+)",
+          "Compare the first pass through the script with the PNGs in this directory",
+          [&goldenDir](std::cmatch const& m)
+          {
+            goldenDir = m[1];
+          }),
+        Opt(
+          "--updateGolden",
+          "Write the PNGs in goldenDir instead of comparing with them",
+          [&updateGolden](std::cmatch const& m)
+          {
+            updateGolden = true;
+          })}) )
+  {
+    return 1;
+  }
+
+  // the edits are saved by LeverFrame, to a copy so the frame given is
+  // left as it was
+  auto scratchPath = "/tmp/servoset-renderbench-" + std::to_string(getpid()) + ".frame";
+  int mismatches = 0;
+  try
+  {
+    // not FrameCache::load, that would write a cache beside the frame
+    FrameCache frame(
+      framefile::load(
+        frameFileName,
+        [&frameFileName](FrameError const& e)
+        {
+          std::cerr << frameFileName << ":" << e.what() << std::endl;
+        }));
+    auto levers = frame.size();
+    if( levers == 0 )
+    {
+      throw std::runtime_error(frameFileName + ": no levers");
+    }
+
+    // no window is opened, but SDL still wants a video driver
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    auto sdlLib = sdl::init();
+    auto ttfLib = sdl::ttf::init();
+
+    sdl::surface screen(
+      SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888),
+      SDL_FreeSurface);
+    if( !screen )
+    {
+      sdl::throw_error("Failed to create screen surface: ");
+    }
+    sdl::renderer renderer(SDL_CreateSoftwareRenderer(screen.get()), SDL_DestroyRenderer);
+    if( !renderer )
+    {
+      sdl::throw_error("Failed to create software renderer: ");
+    }
+
+    // no serial port, edits are dropped
+    ServoController servoController("", 9600, "");
+    int goldenSteps = 0;
+    std::map<std::string, Timings> timings;
+    {
+      LeverFrame leverFrame(
+        scratchPath,
+        frame,
+        fontFileName,
+        SDL_Rect{0, 0, width, height},
+        servoController);
+
+      auto draw = [&]()
+      {
+        auto start = std::chrono::steady_clock::now();
+        auto drawn = leverFrame.render(renderer);
+        SDL_RenderPresent(renderer.get());
+        return std::make_pair(drawn, std::chrono::steady_clock::now() - start);
+      };
+
+      // builds the glyph atlas and background
+      auto first = draw();
+      timings["first"].ns_.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(first.second).count());
+
+      auto steps = script();
+      for( unsigned long frame = 0; frame < frames; frame++ )
+      {
+        auto& step = steps[frame % steps.size()];
+        step.action_(leverFrame);
+        auto drawn = draw();
+        auto& t = timings[step.name_];
+        if( drawn.first )
+        {
+          t.ns_.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(drawn.second).count());
+        }
+        else
+        {
+          t.skipped_++;
+        }
+
+        if( !goldenDir.empty() && frame < steps.size() )
+        {
+          char name[32];
+          snprintf(name, sizeof(name), "/step-%02lu.png", frame);
+          auto goldenFile = goldenDir + name;
+          if( updateGolden )
+          {
+            if( IMG_SavePNG(screen.get(), goldenFile.c_str()) != 0 )
+            {
+              throw std::runtime_error(goldenFile + ": " + IMG_GetError());
+            }
+          }
+          else
+          {
+            auto differing = comparePixels(screen.get(), goldenFile);
+            if( differing != 0 )
+            {
+              mismatches++;
+            }
+            std::cout << "{\"check\":\"golden\",\"step\":" << frame
+                      << ",\"action\":\"" << step.name_ << "\""
+                      << ",\"differing_pixels\":" << differing
+                      << "}" << std::endl;
+          }
+          goldenSteps++;
+        }
+      }
+    }
+
+    for( auto&& t : timings )
+    {
+      report(t.first, levers, t.second);
+    }
+    if( updateGolden )
+    {
+      std::cout << "Wrote " << goldenSteps << " golden images to " << goldenDir << std::endl;
+    }
+  }
+  catch(std::exception const& e)
+  {
+    std::cerr << "An exception occurred: " << e.what() << std::endl;
+    mismatches = -1;
+  }
+  std::remove(scratchPath.c_str());
+
+  return mismatches < 0 ? 2 : mismatches > 0 ? 1 : 0;
+}
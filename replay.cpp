@@ -0,0 +1,164 @@
+// Plays a packet trace recorded by rpi-servoset with --recordFile back
+// into a serial port or pty, at the original timing or as fast as the
+// port will take it
+//
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include <opt-parse/opt-parse.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+
+#include "packettrace.h"
+#include "servolink.h"
+
+namespace
+{
+  void writeAll(int fd, std::string const& bytes)
+  {
+    std::size_t pos = 0;
+    while( pos < bytes.size() )
+    {
+      auto written = write(fd, bytes.data() + pos, bytes.size() - pos);
+      if( written >= 0 )
+      {
+        pos += written;
+      }
+      else if( errno == EAGAIN || errno == EWOULDBLOCK )
+      {
+        pollfd out{fd, POLLOUT, 0};
+        poll(&out, 1, -1);
+      }
+      else if( errno != EINTR )
+      {
+        throw std::runtime_error(std::string("Write failed: ") + std::strerror(errno));
+      }
+    }
+  }
+
+  template<typename Duration>
+  double to_ms(Duration d)
+  {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::string traceFileName;
+  std::string serialPort;
+  unsigned int baudRate = 9600;
+  bool fast = false;
+  int link = -1;
+
+  if( !Opt::parseCmdLine(argc, argv, {
+        Opt(
+          "--traceFile=(.+)",
+          "Packet trace to play back",
+          [&traceFileName](std::cmatch const& m)
+          {
+            traceFileName = m[1];
+          },
+          true),
+        Opt(
+          "--serialPort=(.+)",
+          "Serial port or pty to write the packets to",
+          [&serialPort](std::cmatch const& m)
+          {
+            serialPort = m[1];
+          },
+          true),
+        Opt(
+          "--baudRate=([0-9]+)",
+          "Baud rate to set on the port (default 9600)",
+          [&baudRate](std::cmatch const& m)
+          {
+            baudRate = std::stoi(m[1]);
+          }),
+        Opt(
+          "--link=([0-9]+)",
+          "Only play packets sent to this board's link (default all links)",
+          [&link](std::cmatch const& m)
+          {
+            link = std::stoi(m[1]);
+          }),
+        Opt(
+          "--fast",
+          "Write packets as fast as the port takes them instead of at their recorded times",
+          [&fast](std::cmatch const& m)
+          {
+            fast = true;
+          })}) )
+  {
+    return 1;
+  }
+
+  try
+  {
+    auto packets = packettrace::load(traceFileName);
+    int fd = ServoLink::openPort(serialPort, baudRate);
+
+    unsigned long played = 0;
+    unsigned long bytes = 0;
+    auto maxLate = std::chrono::steady_clock::duration::zero();
+    auto start = std::chrono::steady_clock::now();
+    auto selected = [link](packettrace::Packet const& packet)
+    {
+      return link < 0 || packet.link_ == static_cast<unsigned int>(link);
+    };
+    // timed from the first packet played, not the first in the trace,
+    // so other links' packets before it don't hold up the replay
+    auto firstPlayed = std::find_if(packets.begin(), packets.end(), selected);
+    auto first = firstPlayed == packets.end() ? std::chrono::nanoseconds() : firstPlayed->time_;
+    for( auto&& packet : packets )
+    {
+      if( !selected(packet) )
+      {
+        continue;
+      }
+      if( !fast )
+      {
+        auto due = start + (packet.time_ - first);
+        std::this_thread::sleep_until(due);
+        maxLate = std::max(maxLate, std::chrono::steady_clock::now() - due);
+      }
+      writeAll(fd, packet.bytes_);
+      played++;
+      bytes += packet.bytes_.size();
+    }
+    tcdrain(fd);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    close(fd);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "Played " << played << " of " << packets.size() << " packets, "
+              << bytes << " bytes in " << to_ms(elapsed) << "ms";
+    if( elapsed.count() > 0 )
+    {
+      std::cout << ", " << played * 1000 / to_ms(elapsed) << " packets/sec";
+    }
+    if( !fast )
+    {
+      std::cout << ", at most " << to_ms(maxLate) << "ms late";
+    }
+    std::cout << std::endl;
+  }
+  catch(std::exception const& e)
+  {
+    std::cerr << "An exception occurred: " << e.what() << std::endl;
+    return 2;
+  }
+
+  return 0;
+}
@@ -0,0 +1,112 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined SERVO4_H
+#define SERVO4_H
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+// The MERG Servo4 serial protocol. Each packet is a nul, a command byte and
+// the value as three decimal digits.
+namespace servo4
+{
+  std::size_t const packetSize = 5;
+  unsigned int const store = 0x40;
+  unsigned int const reset = 0x23;
+  unsigned int const maxValue = 999;
+
+  // direction and function as ServoController's enums
+  constexpr unsigned int command(
+    unsigned int connection,
+    unsigned int direction,
+    unsigned int function)
+  {
+    return 0x41 + (connection * 4) + (function * 2) + direction;
+  }
+
+  // the three digits of every value, worked out by the compiler
+  constexpr std::array<std::array<char, 3>, maxValue + 1> digits = []()
+  {
+    std::array<std::array<char, 3>, maxValue + 1> table{};
+    for( unsigned int value = 0; value <= maxValue; value++ )
+    {
+      table[value][0] = static_cast<char>('0' + value / 100);
+      table[value][1] = static_cast<char>('0' + value / 10 % 10);
+      table[value][2] = static_cast<char>('0' + value % 10);
+    }
+    return table;
+  }();
+
+  // writes packetSize bytes at out, values above maxValue are clamped
+  inline void encode(unsigned int cmd, unsigned int value, char* out)
+  {
+    out[0] = 0;
+    out[1] = static_cast<char>(cmd);
+    std::memcpy(out + 2, digits[value < maxValue ? value : maxValue].data(), 3);
+  }
+
+  // Splits a byte stream back into packets, resynchronising on the next nul
+  // after anything malformed
+  class Decoder
+  {
+  public:
+    Decoder()
+      : len_(0)
+      , errors_(0)
+    {
+    }
+
+    // handler is called with the command and value of each whole packet
+    template<typename Handler>
+    void decode(char const* data, std::size_t size, Handler handler)
+    {
+      for( std::size_t i = 0; i < size; i++ )
+      {
+        auto c = data[i];
+        if( len_ == 0 )
+        {
+          if( c == 0 )
+          {
+            buf_[len_++] = c;
+          }
+          else
+          {
+            errors_++;
+          }
+        }
+        else if( len_ >= 2 && (c < '0' || c > '9') )
+        {
+          errors_++;
+          len_ = c == 0 ? 1 : 0;
+        }
+        else
+        {
+          buf_[len_++] = c;
+          if( len_ == packetSize )
+          {
+            handler(
+              static_cast<unsigned int>(static_cast<unsigned char>(buf_[1])),
+              static_cast<unsigned int>(
+                (buf_[2] - '0') * 100 + (buf_[3] - '0') * 10 + (buf_[4] - '0')));
+            len_ = 0;
+          }
+        }
+      }
+    }
+
+    // bytes discarded
+    unsigned long errors() const
+    {
+      return errors_;
+    }
+
+  private:
+    char buf_[packetSize];
+    std::size_t len_;
+    unsigned long errors_;
+  };
+}
+
+#endif // !defined SERVO4_H
@@ -0,0 +1,557 @@
+// Simulates a MERG Servo4 board on a pseudo-terminal so ServoController
+// can be exercised without hardware
+//
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include <opt-parse/opt-parse.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "controlserver.h"
+#include "framecache.h"
+#include "latency.h"
+#include "servo4.h"
+#include "servocontroller.h"
+
+using namespace std::chrono_literals;
+
+namespace
+{
+  std::atomic<bool> stopRequested(false);
+
+  void requestStop(int)
+  {
+    stopRequested = true;
+  }
+
+  struct Packet
+  {
+    std::chrono::steady_clock::time_point received_;
+    unsigned int cmd_;
+    unsigned int value_;
+  };
+
+  // State of the four connectors on one board
+  class Servo4
+  {
+  public:
+    Servo4()
+      : servos_{}
+      , stores_(0)
+      , resets_(0)
+    {
+    }
+
+    void apply(Packet const& pkt)
+    {
+      if( pkt.cmd_ == servo4::store )
+      {
+        stores_++;
+      }
+      else if( pkt.cmd_ == servo4::reset )
+      {
+        resets_++;
+        servos_ = {};
+      }
+      else if( pkt.cmd_ >= servo4::command(0, 0, 0) && pkt.cmd_ < servo4::command(4, 0, 0) )
+      {
+        auto offset = pkt.cmd_ - servo4::command(0, 0, 0);
+        auto& servo = servos_[offset / 4];
+        auto direction = offset % 2;
+        if( (offset / 2) % 2 == ServoController::Position )
+        {
+          servo.position_[direction] = pkt.value_;
+          servo.current_ = pkt.value_;
+        }
+        else
+        {
+          servo.speed_[direction] = pkt.value_;
+        }
+      }
+    }
+
+    void write(std::ostream& os) const
+    {
+      for( std::size_t i = 0; i < servos_.size(); i++ )
+      {
+        auto& servo = servos_[i];
+        os << "Connector " << i
+           << ": at " << servo.current_
+           << ", positions " << servo.position_[0] << "/" << servo.position_[1]
+           << ", speeds " << servo.speed_[0] << "/" << servo.speed_[1]
+           << std::endl;
+      }
+      os << "Stores " << stores_ << ", resets " << resets_ << std::endl;
+    }
+
+  private:
+    struct Servo
+    {
+      unsigned int current_;
+      unsigned int position_[2];
+      unsigned int speed_[2];
+    };
+
+    std::array<Servo, 4> servos_;
+    unsigned long stores_;
+    unsigned long resets_;
+  };
+
+  // Master side of a raw pseudo-terminal
+  class Pty
+  {
+  public:
+    Pty()
+      : fd_(posix_openpt(O_RDWR | O_NOCTTY))
+    {
+      if( fd_ < 0 || grantpt(fd_) < 0 || unlockpt(fd_) < 0 )
+      {
+        throw std::runtime_error(std::strerror(errno));
+      }
+      name_ = ptsname(fd_);
+
+      struct termios term_options;
+      tcgetattr(fd_, &term_options);
+      cfmakeraw(&term_options);
+      tcsetattr(fd_, TCSANOW, &term_options);
+
+      // keep the slave open so reads don't fail with EIO between clients
+      slave_ = open(name_.c_str(), O_RDWR | O_NOCTTY);
+    }
+
+    ~Pty()
+    {
+      close(slave_);
+      close(fd_);
+    }
+
+    int fd() const
+    {
+      return fd_;
+    }
+
+    std::string const& name() const
+    {
+      return name_;
+    }
+
+  private:
+    int fd_;
+    int slave_;
+    std::string name_;
+  };
+
+  // Reads packets from the pty until stop is set
+  template<typename Handler>
+  unsigned long receive(Pty const& pty, std::atomic<bool> const& stop, Handler handler)
+  {
+    servo4::Decoder decoder;
+    char buf[256];
+    while( !stop && !stopRequested )
+    {
+      pollfd in{pty.fd(), POLLIN, 0};
+      if( poll(&in, 1, 100) > 0 )
+      {
+        auto n = read(pty.fd(), buf, sizeof(buf));
+        if( n > 0 )
+        {
+          auto now = std::chrono::steady_clock::now();
+          decoder.decode(
+            buf,
+            n,
+            [&handler, now](unsigned int cmd, unsigned int value)
+            {
+              handler(Packet{now, cmd, value});
+            });
+        }
+      }
+    }
+    return decoder.errors();
+  }
+
+  template<typename Duration>
+  double to_ms(Duration d)
+  {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+
+  void writeLatencies(std::ostream& os, std::vector<double> latencies)
+  {
+    if( latencies.empty() )
+    {
+      os << "No packets matched" << std::endl;
+      return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p)
+                      {
+                        return latencies[static_cast<std::size_t>(p * (latencies.size() - 1))];
+                      };
+    os << std::fixed << std::setprecision(3)
+       << "Latency ms: min " << latencies.front()
+       << ", p50 " << percentile(0.5)
+       << ", p99 " << percentile(0.99)
+       << ", max " << latencies.back()
+       << " (" << latencies.size() << " samples)"
+       << std::endl;
+  }
+
+  // what competes with the panel during the self test
+  enum class Remote
+  {
+    None,
+    Session, // a session driven through ServoController
+    Client   // a client of a ControlServer
+  };
+
+  // A control socket client that runs lines and waits for their replies
+  class ControlClient
+  {
+  public:
+    ControlClient(std::string const& path)
+      : fd_(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0))
+    {
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+      if( fd_ < 0 ||
+          connect(fd_, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) < 0 )
+      {
+        auto error = path + ": " + std::strerror(errno);
+        if( fd_ >= 0 )
+        {
+          close(fd_);
+        }
+        throw std::runtime_error(error);
+      }
+    }
+
+    ~ControlClient()
+    {
+      close(fd_);
+    }
+
+    // returns the number of replies that weren't "ok"
+    unsigned int run(std::string const& lines)
+    {
+      for( std::size_t pos = 0; pos < lines.size(); )
+      {
+        auto n = write(fd_, lines.data() + pos, lines.size() - pos);
+        if( n < 0 && errno != EINTR )
+        {
+          throw std::runtime_error(std::string("Control socket write failed: ") + std::strerror(errno));
+        }
+        pos += std::max<ssize_t>(n, 0);
+      }
+
+      auto expected = std::count(lines.begin(), lines.end(), '\n');
+      unsigned int failed = 0;
+      while( expected > 0 )
+      {
+        auto end = replies_.find('\n');
+        if( end != std::string::npos )
+        {
+          failed += replies_.compare(0, end, "ok") != 0 ? 1 : 0;
+          replies_.erase(0, end + 1);
+          expected--;
+          continue;
+        }
+        char buf[256];
+        auto n = read(fd_, buf, sizeof(buf));
+        if( n == 0 || (n < 0 && errno != EINTR) )
+        {
+          throw std::runtime_error("Control socket closed");
+        }
+        replies_.append(buf, std::max<ssize_t>(n, 0));
+      }
+      return failed;
+    }
+
+  private:
+    int fd_;
+    std::string replies_;
+  };
+
+  // Drives a ServoController against the simulator and measures the time
+  // from each update() to the matching packet arriving. Unless remote is
+  // None a remote session also starts, updates and finishes connector 1
+  // every millisecond, and the test fails unless nearly all of the panel's
+  // values still get through.
+  int selfTest(unsigned int updates, unsigned int interval, unsigned int baudRate, Remote remote)
+  {
+    Pty pty;
+    std::array<std::atomic<long long>, 256> sent;
+    std::vector<double> latencies;
+    std::atomic<bool> stop(false);
+    Servo4 board;
+    unsigned long packets = 0;
+    auto first = std::chrono::steady_clock::time_point();
+    auto last = first;
+    unsigned int refused = 0;
+
+    for( auto&& s : sent )
+    {
+      s = 0;
+    }
+
+    std::thread receiver(
+      [&]()
+      {
+        receive(
+          pty,
+          stop,
+          [&](Packet const& pkt)
+          {
+            if( packets++ == 0 )
+            {
+              first = pkt.received_;
+            }
+            last = pkt.received_;
+            board.apply(pkt);
+            if( pkt.cmd_ != servo4::command(0, ServoController::Normal, ServoController::Position) )
+            {
+              return;
+            }
+            auto sentAt = pkt.value_ < sent.size() ? sent[pkt.value_].exchange(0) : 0;
+            if( sentAt != 0 )
+            {
+              latencies.push_back(
+                to_ms(pkt.received_.time_since_epoch() - std::chrono::nanoseconds(sentAt)));
+            }
+          });
+      });
+    // if the controller or control server can't be made the receiver has
+    // to be stopped before it is destroyed
+    struct StopReceiver
+    {
+      ~StopReceiver()
+      {
+        stop_ = true;
+        if( receiver_.joinable() )
+        {
+          receiver_.join();
+        }
+      }
+
+      std::atomic<bool>& stop_;
+      std::thread& receiver_;
+    } stopReceiver{stop, receiver};
+
+    {
+      ServoController servoController(pty.name(), baudRate, "");
+      auto stamp = [&sent](unsigned int value)
+                   {
+                     sent[value] = std::chrono::steady_clock::now().time_since_epoch().count();
+                   };
+      std::atomic<bool> panelDone(false);
+      std::atomic<unsigned int> remoteErrors(0);
+      std::unique_ptr<ControlServer> controlServer;
+      auto socketPath = "/tmp/servo4-sim-" + std::to_string(getpid()) + ".sock";
+      if( remote == Remote::Client )
+      {
+        FrameCache frame({
+          LeverRecord{"1", 0, 0, 'P', 0, 0, 0, 0, "Panel"},
+          LeverRecord{"2", 0, 1, 'P', 0, 0, 0, 0, "Remote"}});
+        controlServer.reset(new ControlServer(socketPath, frame, servoController));
+      }
+      std::thread remoteSession;
+      if( remote != Remote::None )
+      {
+        remoteSession = std::thread(
+          [&]()
+          {
+            std::unique_ptr<ControlClient> client;
+            if( controlServer )
+            {
+              client.reset(new ControlClient(socketPath));
+            }
+            for( unsigned int i = 0; !panelDone; i++ )
+            {
+              if( client )
+              {
+                remoteErrors += client->run(
+                  "start,2,normal," + std::to_string(i % 256) + "\n"
+                  "update," + std::to_string((i + 1) % 256) + "\n"
+                  "finish\n");
+              }
+              else
+              {
+                servoController.start(1, 0, 1, ServoController::Normal, ServoController::Position, i % 256);
+                servoController.update(1, (i + 1) % 256);
+                servoController.finish(1);
+              }
+              std::this_thread::sleep_for(1ms);
+            }
+          });
+      }
+
+      stamp(0);
+      servoController.start(0, 0, ServoController::Normal, ServoController::Position, 0);
+      for( unsigned int i = 1; i <= updates && !stopRequested; i++ )
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        stamp(i % 256);
+        latency::begin(latency::Clock::now());
+        servoController.update(i % 256);
+        latency::begin({});
+      }
+      servoController.finish();
+      panelDone = true;
+      if( remoteSession.joinable() )
+      {
+        remoteSession.join();
+      }
+      controlServer.reset();
+      refused = remoteErrors;
+      std::this_thread::sleep_for(200ms);
+    }
+    stop = true;
+    receiver.join();
+
+    board.write(std::cout);
+    std::cout << "Packets " << packets;
+    if( packets > 1 )
+    {
+      std::cout << ", " << (packets - 1) * 1000 / to_ms(last - first) << " packets/sec";
+    }
+    std::cout << std::endl;
+    // the start's value and every update's
+    auto written = latencies.size();
+    std::cout << "Panel values written " << written << " of " << updates + 1 << std::endl;
+    if( refused > 0 )
+    {
+      std::cout << "Remote commands refused " << refused << std::endl;
+    }
+    writeLatencies(std::cout, std::move(latencies));
+    latency::write(std::cout);
+    return refused > 0 || (remote != Remote::None && written < (updates + 1) * 9 / 10) ? 1 : 0;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  bool verbose = false;
+  unsigned int selfTestUpdates = 0;
+  unsigned int interval = 20;
+  unsigned int baudRate = 9600;
+  Remote remote = Remote::None;
+
+  if( !Opt::parseCmdLine(argc, argv, {
+        Opt(
+          "--verbose",
+          "Print every packet received",
+          [&verbose](std::cmatch const& m)
+          {
+            verbose = true;
+          }),
+        Opt(
+          "--selfTest=([0-9]+)",
+          "Drive the simulator with this many updates and report latency",
+          [&selfTestUpdates](std::cmatch const& m)
+          {
+            selfTestUpdates = std::stoi(m[1]);
+          }),
+        Opt(
+          "--interval=([0-9]+)",
+          "Milliseconds between self test updates (default 20)",
+          [&interval](std::cmatch const& m)
+          {
+            interval = std::stoi(m[1]);
+          }),
+        Opt(
+          "--baudRate=([0-9]+)",
+          "Baud rate the self test paces its link for (default 9600)",
+          [&baudRate](std::cmatch const& m)
+          {
+            baudRate = std::stoi(m[1]);
+          }),
+        Opt(
+          "--remoteSession",
+          "Compete with the self test's updates from a remote session",
+          [&remote](std::cmatch const& m)
+          {
+            remote = Remote::Session;
+          }),
+        Opt(
+          "--remoteClient",
+          "Compete with the self test's updates from a control socket client",
+          [&remote](std::cmatch const& m)
+          {
+            remote = Remote::Client;
+          })}) )
+  {
+    return 1;
+  }
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  try
+  {
+    if( selfTestUpdates > 0 )
+    {
+      return selfTest(selfTestUpdates, interval, baudRate, remote);
+    }
+
+    Pty pty;
+    std::cout << "Servo4 simulator listening on " << pty.name() << std::endl;
+
+    Servo4 board;
+    std::atomic<bool> stop(false);
+    unsigned long packets = 0;
+    auto started = std::chrono::steady_clock::now();
+    auto prev = started;
+    auto errors = receive(
+      pty,
+      stop,
+      [&](Packet const& pkt)
+      {
+        packets++;
+        board.apply(pkt);
+        if( verbose )
+        {
+          std::cout << std::fixed << std::setprecision(3)
+                    << to_ms(pkt.received_ - started) << "ms"
+                    << " (+" << to_ms(pkt.received_ - prev) << "ms)"
+                    << " cmd 0x" << std::hex << pkt.cmd_ << std::dec
+                    << " value " << pkt.value_
+                    << std::endl;
+        }
+        prev = pkt.received_;
+      });
+
+    board.write(std::cout);
+    std::cout << "Packets " << packets
+              << ", " << packets * 1000 / to_ms(std::chrono::steady_clock::now() - started)
+              << " packets/sec, " << errors << " bytes discarded"
+              << std::endl;
+  }
+  catch(std::exception const& e)
+  {
+    std::cerr << "An exception occurred: " << e.what() << std::endl;
+    return 2;
+  }
+
+  return 0;
+}
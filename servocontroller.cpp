@@ -3,105 +3,235 @@
 
 #include "servocontroller.h"
 
-#include <cerrno>
-#include <chrono>
-#include <cstring>
-#include <fcntl.h>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <termios.h>
-#include <unistd.h>
+#include <thread>
 
-using namespace std::chrono_literals;
+#include "tokeniser.h"
 
-ServoController::ServoController(std::string const& port)
-  : fd_(-1)
-  , stop_(false)
+ServoController::ServoController(
+  std::string const& defaultPort,
+  unsigned int defaultBaudRate,
+  std::string const& boardFile,
+  PacketRecorder* recorder)
+  : active_(nullptr)
 {
-  if( !port.empty() )
+  if( !defaultPort.empty() )
   {
-    fd_ = open(port.c_str(), O_WRONLY | O_NOCTTY);
-    if( fd_ < 0 )
-    {
-      throw std::runtime_error(std::strerror(errno));
-    }
+    defaultLink_.reset(new ServoLink(defaultPort, defaultBaudRate, protocol::servo4, recorder));
+  }
+  if( !boardFile.empty() )
+  {
+    loadBoards(boardFile, defaultBaudRate, recorder);
+  }
+}
 
-    struct termios term_options;
-    if( tcgetattr(fd_, &term_options) < 0 )
-    {
-      std::cerr << std::strerror(errno) << std::endl;
-    }
+void ServoController::start(
+  unsigned int board,
+  unsigned int connection,
+  Direction direction,
+  Function function,
+  unsigned int value)
+{
+  active_ = link(board);
+  if( active_ != nullptr )
+  {
+    active_->start(active_->protocol().command_(connection, direction, function), value);
+  }
+}
 
-    cfsetospeed(&term_options, B9600);
-    term_options.c_cflag |= CLOCAL | CREAD;
-    term_options.c_cflag &= ~(PARENB | PARODD);
-    term_options.c_cflag &= ~CSTOPB;
-    term_options.c_cflag &= ~CRTSCTS;
-    term_options.c_cflag &= ~CSIZE;
-    term_options.c_cflag |= CS8;
-    term_options.c_oflag = 0;
-    if( tcsetattr(fd_, TCSANOW, &term_options) < 0)
-    {
-      std::cerr << std::strerror(errno) << std::endl;
-    }
+void ServoController::update(unsigned int newValue)
+{
+  if( active_ != nullptr )
+  {
+    latency::record(latency::Update);
+    active_->update(newValue, latency::origin());
   }
 }
 
-ServoController::~ServoController()
+void ServoController::finish()
 {
-  if( fd_ > 0 )
+  if( active_ != nullptr )
   {
-    close(fd_);
-  };
+    active_->finish();
+    active_ = nullptr;
+  }
 }
 
 void ServoController::start(
+  unsigned int session,
+  unsigned int board,
   unsigned int connection,
   Direction direction,
   Function function,
   unsigned int value)
 {
-  curValue_ = value;
-  stopped_ = std::async(
-    std::launch::async,
-    [this, connection, direction, function]()
+  auto active = link(board);
+  if( active == nullptr )
+  {
+    sessions_.erase(session);
+    return;
+  }
+  sessions_[session] = active;
+  active->start(active->protocol().command_(connection, direction, function), value, session);
+}
+
+void ServoController::update(unsigned int session, unsigned int newValue)
+{
+  auto active = sessions_.find(session);
+  if( active != sessions_.end() )
+  {
+    active->second->update(newValue, {}, session);
+  }
+}
+
+void ServoController::finish(unsigned int session)
+{
+  auto active = sessions_.find(session);
+  if( active != sessions_.end() )
+  {
+    active->second->finish(session);
+    sessions_.erase(active);
+  }
+}
+
+void ServoController::set(
+  unsigned int board,
+  unsigned int connection,
+  Direction direction,
+  Function function,
+  unsigned int value,
+  unsigned int session)
+{
+  auto l = link(board);
+  if( l != nullptr )
+  {
+    l->set(l->protocol().command_(connection, direction, function), value, session);
+  }
+}
+
+bool ServoController::hasPort(unsigned int board) const
+{
+  return link(board) != nullptr;
+}
+
+bool ServoController::backedUp(unsigned int session, unsigned int board) const
+{
+  auto l = link(board);
+  return l != nullptr && l->backedUp(session);
+}
+
+bool ServoController::wait(std::chrono::milliseconds timeout) const
+{
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  for(;;)
+  {
+    bool idle = !defaultLink_ || defaultLink_->idle();
+    for( auto&& link : links_ )
     {
-      std::unique_lock<std::mutex> lock(guard_);
-      while( !cv_.wait_for(lock, 100ms, [this]{ return stop_; }) )
-      {
-        send((0x41 + (connection * 4) + (function * 2) + direction), curValue_);
-      }
-      send(0x40, 0);
-      stop_ = false;
-    });
+      idle = idle && link.second->idle();
+    }
+    if( idle )
+    {
+      return true;
+    }
+    if( std::chrono::steady_clock::now() >= deadline )
+    {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
 }
 
-void ServoController::update(unsigned int newValue)
+std::vector<std::pair<std::string, ServoLink::Stats>> ServoController::stats() const
 {
-  std::lock_guard<std::mutex> lock(guard_);
-  curValue_ = newValue;
+  std::vector<std::pair<std::string, ServoLink::Stats>> stats;
+  for( auto&& link : links_ )
+  {
+    stats.emplace_back("Board " + std::to_string(link.first), link.second->stats());
+  }
+  if( defaultLink_ )
+  {
+    stats.emplace_back("Default", defaultLink_->stats());
+  }
+  return stats;
 }
 
-void ServoController::finish()
+void ServoController::writeStats(std::ostream& os) const
 {
+  for( auto&& link : stats() )
   {
-    std::lock_guard<std::mutex> lock(guard_);
-    stop_ = true;
+    auto& stats = link.second;
+    os << link.first
+       << ": " << stats.bytesPerSec_ << "/" << stats.budget_
+       << " bytes/sec, queued " << stats.queueDepth_
+       << ", backlog " << stats.backlog_
+       << ", packets " << stats.packets_
+       << ", coalesced " << stats.coalesced_
+       << ", write errors " << stats.writeErrors_
+       << std::endl;
   }
-  stopped_.get();
 }
 
-void ServoController::send(unsigned int cmd, unsigned int value) const
+void ServoController::loadBoards(
+  std::string const& boardFile,
+  unsigned int defaultBaudRate,
+  PacketRecorder* recorder)
 {
-  // pkt format is:
-  // nul cmd value
-  char buf[6];
-  buf[0] = 0;
-  snprintf(buf + 1, 5, "%c%03d", cmd, value);
-  if( fd_ > 0 )
+  std::ifstream is(boardFile);
+  if( !is.is_open() )
   {
-    write(fd_, buf, 5);
+    throw std::runtime_error("Failed to open board file " + boardFile);
   }
+
+  while( is )
+  {
+    std::string line;
+    std::getline(is, line);
+    if( !line.empty() && line[0] != '#' )
+    {
+      Tokeniser fields(line);
+      unsigned int board = 0;
+      std::string port;
+      unsigned int baudRate = defaultBaudRate;
+      Protocol const* protocol = &protocol::servo4;
+      try
+      {
+        board = std::stoi(std::string(fields.next().second));
+        port = fields.next().second;
+        auto baud = fields.next();
+        if( baud.first && !baud.second.empty() )
+        {
+          baudRate = std::stoi(std::string(baud.second));
+        }
+        auto name = fields.next();
+        if( name.first )
+        {
+          protocol = protocol::find(name.second);
+        }
+      }
+      catch(...)
+      {
+        protocol = nullptr;
+      }
+      if( protocol == nullptr )
+      {
+        std::cerr << "Board incorrectly formatted: " << line << std::endl;
+        continue;
+      }
+      if( port.empty() )
+      {
+        std::cerr << "Board " << board << " has no serial port" << std::endl;
+        continue;
+      }
+      links_[board].reset(new ServoLink(port, baudRate, *protocol, recorder, board));
+    }
+  }
+}
+
+ServoLink* ServoController::link(unsigned int board) const
+{
+  auto l = links_.find(board);
+  return l != links_.end() ? l->second.get() : defaultLink_.get();
 }
@@ -4,11 +4,17 @@
 #if !defined SERVOCONTROLLER_H
 #define SERVOCONTROLLER_H
 
-#include <condition_variable>
-#include <iostream>
-#include <future>
-#include <mutex>
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "servolink.h"
+
+// Routes servo commands to the serial link for the board they address.
 class ServoController
 {
 public:
@@ -24,10 +30,16 @@ public:
     Speed
   };
 
-  ServoController(std::string const& port);
-  ~ServoController();
+  // defaultPort is used for any board not listed in boardFile, either
+  // may be empty. Commands for a board with no port are dropped, see
+  // hasPort(). Packets written are passed to recorder if there is one.
+  ServoController(std::string const& defaultPort,
+                  unsigned int defaultBaudRate,
+                  std::string const& boardFile,
+                  PacketRecorder* recorder = nullptr);
 
   void start(
+    unsigned int board,
     unsigned int connection,
     Direction direction,
     Function function,
@@ -35,16 +47,55 @@ public:
   void update(unsigned int newValue);
   void finish();
 
+  // The same for remote sessions, numbered from 1, which drive servos
+  // alongside the panel. All sessions must be driven from one thread.
+  void start(
+    unsigned int session,
+    unsigned int board,
+    unsigned int connection,
+    Direction direction,
+    Function function,
+    unsigned int value);
+  void update(unsigned int session, unsigned int newValue);
+  void finish(unsigned int session);
+
+  // Sends a value and stores it on the board without waiting for it to be
+  // written, so a batch of sets is pipelined. Sets are bulk traffic and
+  // give way to edits in progress.
+  void set(
+    unsigned int board,
+    unsigned int connection,
+    Direction direction,
+    Function function,
+    unsigned int value,
+    unsigned int session = 0);
+  // true if commands for board go to a serial port
+  bool hasPort(unsigned int board) const;
+  // true while board's link is too far behind to take more commands from
+  // session without them waiting, see ServoLink::backedUp()
+  bool backedUp(unsigned int session, unsigned int board) const;
+
+  // waits for everything sent so far to be written to the ports, returns
+  // false if that took longer than timeout
+  bool wait(std::chrono::milliseconds timeout) const;
+
+  // each link's statistics with a name for it
+  std::vector<std::pair<std::string, ServoLink::Stats>> stats() const;
+  void writeStats(std::ostream& os) const;
+
 private:
-  void send(unsigned int cmd, unsigned int value) const;
+  void loadBoards(
+    std::string const& boardFile,
+    unsigned int defaultBaudRate,
+    PacketRecorder* recorder);
+  // the board's link, or nullptr if it has no port
+  ServoLink* link(unsigned int board) const;
 
 private:
-  int fd_;
-  unsigned int curValue_;
-  bool stop_;
-  std::condition_variable cv_;
-  std::mutex guard_;
-  std::future<void> stopped_;
+  std::map<unsigned int, std::unique_ptr<ServoLink>> links_;
+  std::unique_ptr<ServoLink> defaultLink_; // if there is a default port
+  ServoLink* active_;
+  std::map<unsigned int, ServoLink*> sessions_;
 };
 
 #endif // !defined SERVOCONTROLLER_H
@@ -0,0 +1,623 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#include "servolink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+  // finished edits and sets waiting for the link, from each ring, so
+  // that other sessions can't hold up the panel's commands
+  std::size_t const maxFinishing = 16;
+  std::size_t const maxBulk = 64;
+  // commands a ring may hold before its sessions are told to hold back,
+  // which leaves room for a few more without post() having to wait
+  std::size_t const backedUpCommands = 8;
+
+  std::size_t to_ring(unsigned int session)
+  {
+    return session == 0 ? 0 : 1;
+  }
+
+  // A full counter already wakes the reader so EAGAIN can be ignored
+  void wake(int fd)
+  {
+    uint64_t one = 1;
+    while( write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN )
+    {
+      if( errno != EINTR )
+      {
+        std::cerr << "Failed to wake serial link: " << std::strerror(errno) << std::endl;
+        return;
+      }
+    }
+  }
+
+  // resets the counter so the next poll waits for another wake
+  void clearWake(int fd)
+  {
+    uint64_t count;
+    while( read(fd, &count, sizeof(count)) < 0 && errno == EINTR )
+    {
+    }
+  }
+
+  speed_t to_speed(unsigned int baudRate)
+  {
+    switch( baudRate )
+    {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    }
+    throw std::runtime_error("Unsupported baud rate " + std::to_string(baudRate));
+  }
+
+  // Bytes per second the link can carry. Unsupported rates are refused
+  // here, even without a port, before anything divides by the budget.
+  // 8N1 framing puts 10 bits on the wire for every byte.
+  unsigned int to_budget(unsigned int baudRate)
+  {
+    to_speed(baudRate);
+    return baudRate / 10;
+  }
+}
+
+ServoLink::ServoLink(
+  std::string const& port,
+  unsigned int baudRate,
+  Protocol const& protocol,
+  PacketRecorder* recorder,
+  unsigned int traceLink)
+  : fd_(-1)
+  , wakeFd_(-1)
+  , protocol_(protocol)
+  , recorder_(recorder)
+  , traceLink_(traceLink)
+  , budget_(to_budget(baudRate))
+  , packetInterval_(1000000us * protocol.packetSize_ / budget_)
+  // keep-alives never take more than a tenth of the link
+  , keepAliveInterval_(std::max<std::chrono::microseconds>(100ms, packetInterval_ * 10))
+  // keep-alives and sets get at least one slot in sixteen
+  , agingLimit_(packetInterval_ * 16)
+  , finishingCount_{0, 0}
+  , bulkCount_{0, 0}
+  , outPos_(0)
+  , windowStart_(std::chrono::steady_clock::now())
+  , windowBytes_(0)
+  , bytesPerSec_(0)
+  , packets_(0)
+  , coalesced_(0)
+  , writeErrors_(0)
+  , posted_(0)
+  , handled_(0)
+  , unsent_(0)
+  , backlog_(0)
+  , changed_(0)
+  , oldestQueued_(0)
+{
+  // a value and a store at most are ever waiting to be written
+  outBuf_.reserve(protocol_.packetSize_ * 2);
+  if( !port.empty() )
+  {
+    fd_ = openPort(port, baudRate);
+  }
+
+  wakeFd_ = eventfd(0, EFD_NONBLOCK);
+  if( wakeFd_ < 0 )
+  {
+    throw std::runtime_error(std::strerror(errno));
+  }
+  thread_ = std::thread([this]{ run(); });
+}
+
+ServoLink::~ServoLink()
+{
+  post({Command::Quit, 0, 0, {}, 0});
+  thread_.join();
+  close(wakeFd_);
+  if( fd_ > 0 )
+  {
+    close(fd_);
+  };
+}
+
+int ServoLink::openPort(std::string const& port, unsigned int baudRate)
+{
+  auto speed = to_speed(baudRate);
+  int fd = open(port.c_str(), O_WRONLY | O_NOCTTY | O_NONBLOCK);
+  if( fd < 0 )
+  {
+    throw std::runtime_error(port + ": " + std::strerror(errno));
+  }
+
+  struct termios term_options;
+  if( tcgetattr(fd, &term_options) < 0 )
+  {
+    std::cerr << std::strerror(errno) << std::endl;
+  }
+
+  cfsetospeed(&term_options, speed);
+  term_options.c_cflag |= CLOCAL | CREAD;
+  term_options.c_cflag &= ~(PARENB | PARODD);
+  term_options.c_cflag &= ~CSTOPB;
+  term_options.c_cflag &= ~CRTSCTS;
+  term_options.c_cflag &= ~CSIZE;
+  term_options.c_cflag |= CS8;
+  term_options.c_oflag = 0;
+  if( tcsetattr(fd, TCSANOW, &term_options) < 0)
+  {
+    std::cerr << std::strerror(errno) << std::endl;
+  }
+  return fd;
+}
+
+Protocol const& ServoLink::protocol() const
+{
+  return protocol_;
+}
+
+void ServoLink::start(unsigned int cmd, unsigned int value, unsigned int session)
+{
+  post({Command::Start, cmd, value, {}, session});
+}
+
+void ServoLink::update(
+  unsigned int newValue,
+  latency::Clock::time_point origin,
+  unsigned int session)
+{
+  post({Command::Update, 0, newValue, origin, session});
+}
+
+void ServoLink::finish(unsigned int session)
+{
+  post({Command::Stop, 0, 0, {}, session});
+}
+
+void ServoLink::set(unsigned int cmd, unsigned int value, unsigned int session)
+{
+  post({Command::Set, cmd, value, {}, session});
+}
+
+bool ServoLink::backedUp(unsigned int session) const
+{
+  // the I/O thread empties a ring as soon as it is woken unless the
+  // finished edits or sets queued from it are at their limit
+  return commands_[to_ring(session)].size() >= backedUpCommands;
+}
+
+bool ServoLink::idle() const
+{
+  // handled_ is only advanced once a command has been applied to the
+  // channels and queues, and their state published, after which whatever
+  // it led to is either waiting in a channel or a queue, or is unsent
+  return handled_.load(std::memory_order_acquire) == posted_.load(std::memory_order_relaxed) &&
+    changed_.load(std::memory_order_acquire) == 0 &&
+    backlog_.load(std::memory_order_acquire) == 0 &&
+    unsent_.load(std::memory_order_acquire) == 0;
+}
+
+ServoLink::Stats ServoLink::stats() const
+{
+  auto oldest = oldestQueued_.load(std::memory_order_relaxed);
+  auto age = oldest == 0
+    ? std::chrono::microseconds(0)
+    : std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch() -
+        std::chrono::steady_clock::duration(oldest));
+  return {
+    budget_,
+    bytesPerSec_.load(std::memory_order_relaxed),
+    commands_[0].size() + commands_[1].size(),
+    backlog_.load(std::memory_order_relaxed),
+    static_cast<unsigned int>(std::max<std::chrono::microseconds::rep>(age.count(), 0)),
+    packets_.load(std::memory_order_relaxed),
+    coalesced_.load(std::memory_order_relaxed),
+    writeErrors_.load(std::memory_order_relaxed)};
+}
+
+void ServoLink::post(Command const& command)
+{
+  // the I/O thread drains the ring continuously so it is only ever full
+  // briefly, if at all
+  auto& commands = commands_[to_ring(command.session_)];
+  while( !commands.push(command) )
+  {
+    std::this_thread::yield();
+  }
+  posted_.fetch_add(1, std::memory_order_relaxed);
+  wake(wakeFd_);
+}
+
+void ServoLink::run()
+{
+  std::map<unsigned int, Channel> channels;
+  unsigned int lastServed = 0;
+  auto lastSend = std::chrono::steady_clock::now() - keepAliveInterval_;
+  auto lastBulk = lastSend;
+
+  // what goes in the next packet slot, and when
+  enum Source
+  {
+    Nothing,
+    Finishing,
+    Edit,
+    KeepAlive,
+    Bulk
+  };
+  struct Slot
+  {
+    Source source_;
+    std::map<unsigned int, Channel>::iterator channel_;
+    unsigned int session_; // whose finished edit goes
+    std::chrono::steady_clock::time_point due_;
+  };
+
+  // how many sessions after the last one served a session's turn is, so
+  // that the session after lastServed is 0 and lastServed itself is last
+  auto turn = [&lastServed](unsigned int session)
+  {
+    return session - (lastServed + 1);
+  };
+
+  // Finished edits and changed values go first, then keep-alives once a
+  // channel has been idle, then sets. A keep-alive or set that has waited
+  // agingLimit_ goes ahead of everything. Sessions take turns at edits,
+  // finished or not, so no session can starve the others.
+  auto schedule = [&](std::chrono::steady_clock::time_point now)
+  {
+    auto edit = channels.end();
+    auto keepAlive = channels.end();
+    auto keepAliveDue = std::chrono::steady_clock::time_point::max();
+    for( auto c = channels.begin(); c != channels.end(); c++ )
+    {
+      if( c->second.changed_ )
+      {
+        if( edit == channels.end() || turn(c->first) < turn(edit->first) )
+        {
+          edit = c;
+        }
+      }
+      else if( c->second.lastSend_ + keepAliveInterval_ < keepAliveDue )
+      {
+        keepAliveDue = c->second.lastSend_ + keepAliveInterval_;
+        keepAlive = c;
+      }
+    }
+    auto finished = finishing_.end();
+    for( auto f = finishing_.begin(); f != finishing_.end(); f++ )
+    {
+      if( finished == finishing_.end() || turn(f->first) < turn(finished->first) )
+      {
+        finished = f;
+      }
+    }
+
+    auto linkFree = lastSend + packetInterval_;
+    if( keepAlive != channels.end() && now >= keepAliveDue + agingLimit_ )
+    {
+      return Slot{KeepAlive, keepAlive, 0, linkFree};
+    }
+    if( !bulk_.empty() && now >= std::max(lastBulk, bulk_.front().queued_) + agingLimit_ )
+    {
+      return Slot{Bulk, channels.end(), 0, linkFree};
+    }
+    // a session's finished edit goes before its next one
+    if( finished != finishing_.end() &&
+        (edit == channels.end() || turn(finished->first) <= turn(edit->first)) )
+    {
+      return Slot{Finishing, channels.end(), finished->first, linkFree};
+    }
+    if( edit != channels.end() )
+    {
+      return Slot{Edit, edit, 0, linkFree};
+    }
+    if( keepAlive != channels.end() && now >= keepAliveDue )
+    {
+      return Slot{KeepAlive, keepAlive, 0, linkFree};
+    }
+    if( !bulk_.empty() )
+    {
+      return Slot{Bulk, channels.end(), 0, linkFree};
+    }
+    if( keepAlive != channels.end() )
+    {
+      return Slot{KeepAlive, keepAlive, 0, std::max(linkFree, keepAliveDue)};
+    }
+    return Slot{Nothing, channels.end(), 0, std::chrono::steady_clock::time_point::max()};
+  };
+
+  for(;;)
+  {
+    // while the out buffer is full wait for the port to drain instead
+    int timeout = -1;
+    auto slot = schedule(std::chrono::steady_clock::now());
+    if( outBuf_.empty() && slot.source_ != Nothing )
+    {
+      // rounded up, a slot due in under a millisecond would otherwise
+      // spin until it was
+      auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+        slot.due_ - std::chrono::steady_clock::now()).count();
+      timeout = remaining > 0 ? remaining : 0;
+    }
+    else if( windowBytes_ > 0 || bytesPerSec_ > 0 )
+    {
+      // let the measured rate fall back to zero when the link goes idle
+      timeout = 1000;
+    }
+
+    pollfd fds[] =
+    {
+      { wakeFd_, POLLIN, 0 },
+      { fd_, POLLOUT, 0 }
+    };
+    if( poll(fds, outBuf_.empty() ? 1 : 2, timeout) > 0 &&
+        (fds[0].revents & POLLIN) != 0 )
+    {
+      clearWake(wakeFd_);
+    }
+
+    // apply everything queued so far so that only the latest value is
+    // sent. Once a ring's queues are full its commands are left in it,
+    // which holds up whoever is sending them but not the other ring.
+    Command command;
+    while( (hasRoom(0) && commands_[0].pop(command)) ||
+           (hasRoom(1) && commands_[1].pop(command)) )
+    {
+      auto now = std::chrono::steady_clock::now();
+      auto channel = channels.find(command.session_);
+      switch( command.type_ )
+      {
+      case Command::Start:
+        {
+          auto& started = channels[command.session_];
+          started.changed_ = true;
+          started.cmd_ = command.cmd_;
+          started.value_ = command.value_;
+          started.origin_ = {};
+        }
+        break;
+      case Command::Update:
+        if( channel != channels.end() )
+        {
+          auto& updated = channel->second;
+          if( updated.changed_ )
+          {
+            coalesced_.fetch_add(1, std::memory_order_relaxed);
+          }
+          updated.changed_ = updated.changed_ || updated.value_ != command.value_;
+          updated.value_ = command.value_;
+          updated.origin_ = command.origin_;
+        }
+        break;
+      case Command::Stop:
+        // the final value, if it hasn't been sent, and the store always go
+        if( channel != channels.end() )
+        {
+          auto& stopped = channel->second;
+          auto& finishing = finishing_[command.session_];
+          if( stopped.changed_ )
+          {
+            finishing.push_back({command.session_, stopped.cmd_, stopped.value_, true, stopped.origin_, now});
+          }
+          else
+          {
+            finishing.push_back({command.session_, protocol_.store_, 0, false, {}, now});
+          }
+          finishingCount_[to_ring(command.session_)]++;
+          channels.erase(channel);
+        }
+        break;
+      case Command::Set:
+        bulk_.push_back({command.session_, command.cmd_, command.value_, true, {}, now});
+        bulkCount_[to_ring(command.session_)]++;
+        break;
+      case Command::Quit:
+        drain();
+        return;
+      }
+      publishBacklog(channels);
+      handled_.fetch_add(1, std::memory_order_release);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    rollWindow(now);
+    // packets only go into an empty buffer so a slow port coalesces values
+    // rather than building up a backlog of stale positions
+    slot = schedule(now);
+    if( outBuf_.empty() && slot.source_ != Nothing && now >= slot.due_ )
+    {
+      Pending pending{0, 0, 0, false, {}, now};
+      switch( slot.source_ )
+      {
+      case Finishing:
+        {
+          auto finishing = finishing_.find(slot.session_);
+          pending = finishing->second.front();
+          finishing->second.pop_front();
+          if( finishing->second.empty() )
+          {
+            finishing_.erase(finishing);
+          }
+          finishingCount_[to_ring(slot.session_)]--;
+          lastServed = slot.session_;
+        }
+        break;
+      case Bulk:
+        pending = bulk_.front();
+        bulk_.pop_front();
+        bulkCount_[to_ring(pending.session_)]--;
+        lastBulk = now;
+        break;
+      default:
+        {
+          auto& sent = slot.channel_->second;
+          pending = {slot.channel_->first, sent.cmd_, sent.value_, false, sent.changed_ ? sent.origin_ : latency::Clock::time_point(), now};
+          sent.changed_ = false;
+          sent.lastSend_ = now;
+          lastServed = slot.channel_->first;
+        }
+        break;
+      }
+      queue(pending.cmd_, pending.value_);
+      outOrigin_ = pending.origin_;
+      lastSend = now;
+      if( pending.store_ )
+      {
+        // a value and its store go together and take two slots
+        queue(protocol_.store_, 0);
+        lastSend += packetInterval_;
+      }
+      publishBacklog(channels);
+    }
+    flush();
+  }
+}
+
+bool ServoLink::hasRoom(std::size_t ring) const
+{
+  return finishingCount_[ring] < maxFinishing && bulkCount_[ring] < maxBulk;
+}
+
+void ServoLink::queue(unsigned int cmd, unsigned int value)
+{
+  auto end = outBuf_.size();
+  outBuf_.resize(end + protocol_.packetSize_);
+  protocol_.encode_(cmd, value, &outBuf_[end]);
+  if( recorder_ != nullptr )
+  {
+    recorder_->record(traceLink_, &outBuf_[end], protocol_.packetSize_);
+  }
+  unsent_.store(outBuf_.size() - outPos_, std::memory_order_release);
+  packets_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ServoLink::flush()
+{
+  while( fd_ > 0 && outPos_ < outBuf_.size() )
+  {
+    auto written = write(fd_, &outBuf_[outPos_], outBuf_.size() - outPos_);
+    if( written >= 0 )
+    {
+      outPos_ += written;
+      windowBytes_ += written;
+    }
+    else if( errno == EAGAIN || errno == EWOULDBLOCK )
+    {
+      // wait for poll to report the port writable
+      return;
+    }
+    else if( errno != EINTR )
+    {
+      std::cerr << "Serial write failed: " << std::strerror(errno) << std::endl;
+      writeErrors_.fetch_add(1, std::memory_order_relaxed);
+      break;
+    }
+  }
+  if( fd_ > 0 && outPos_ == outBuf_.size() )
+  {
+    latency::record(latency::Write, outOrigin_);
+  }
+  outBuf_.clear();
+  outPos_ = 0;
+  outOrigin_ = {};
+  unsent_.store(0, std::memory_order_release);
+}
+
+void ServoLink::drain()
+{
+  // give final stops and any sets still queued up to a second to get out
+  // of the port
+  auto queuePending = [this](std::deque<Pending> const& queued)
+  {
+    for( auto&& pending : queued )
+    {
+      queue(pending.cmd_, pending.value_);
+      if( pending.store_ )
+      {
+        queue(protocol_.store_, 0);
+      }
+    }
+  };
+  for( auto&& finishing : finishing_ )
+  {
+    queuePending(finishing.second);
+  }
+  queuePending(bulk_);
+  finishing_.clear();
+  bulk_.clear();
+  auto deadline = std::chrono::steady_clock::now() + 1s;
+  flush();
+  while( !outBuf_.empty() && std::chrono::steady_clock::now() < deadline )
+  {
+    pollfd out{fd_, POLLOUT, 0};
+    poll(&out, 1, 100);
+    flush();
+  }
+}
+
+void ServoLink::publishBacklog(std::map<unsigned int, Channel> const& channels)
+{
+  changed_.store(
+    std::count_if(
+      channels.begin(),
+      channels.end(),
+      [](std::pair<unsigned int const, Channel> const& c){ return c.second.changed_; }),
+    std::memory_order_release);
+
+  std::chrono::steady_clock::rep oldest = 0;
+  auto older = [&oldest](std::deque<Pending> const& queued)
+  {
+    if( !queued.empty() &&
+        (oldest == 0 || queued.front().queued_.time_since_epoch().count() < oldest) )
+    {
+      oldest = queued.front().queued_.time_since_epoch().count();
+    }
+  };
+  for( auto&& finishing : finishing_ )
+  {
+    older(finishing.second);
+  }
+  older(bulk_);
+  oldestQueued_.store(oldest, std::memory_order_relaxed);
+  backlog_.store(
+    finishingCount_[0] + finishingCount_[1] + bulk_.size(),
+    std::memory_order_release);
+}
+
+void ServoLink::rollWindow(std::chrono::steady_clock::time_point now)
+{
+  auto elapsed = now - windowStart_;
+  if( elapsed >= 1s )
+  {
+    bytesPerSec_.store(
+      windowBytes_ * 1000 /
+        std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(),
+      std::memory_order_relaxed);
+    windowStart_ = now;
+    windowBytes_ = 0;
+  }
+}
@@ -0,0 +1,165 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined SERVOLINK_H
+#define SERVOLINK_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency.h"
+#include "packettrace.h"
+#include "protocol.h"
+#include "spscring.h"
+
+// A serial connection to a single Servo4 board. Commands are passed from
+// the UI thread, and from one other thread, to a long-lived I/O thread
+// without locking. The I/O thread paces its sends to what the link's baud
+// rate can carry and writes to the port without blocking. Each packet slot
+// goes to edits first, with sessions taking turns, then keep-alives, then
+// sets, with aging so that neither of the last two can be starved.
+class ServoLink
+{
+public:
+  struct Stats
+  {
+    unsigned int budget_;      // bytes/sec the link can carry
+    unsigned int bytesPerSec_; // bytes/sec sent over the last second
+    std::size_t queueDepth_;   // commands waiting for the I/O thread
+    std::size_t backlog_;      // sets and finished edits waiting for the link
+    unsigned int age_;         // us the oldest of those has been waiting
+    unsigned long packets_;    // packets written
+    unsigned long coalesced_;  // values replaced before they were sent
+    unsigned long writeErrors_; // writes that failed, their packets are lost
+  };
+
+  // every packet written is passed to recorder, if there is one, as
+  // from traceLink
+  ServoLink(
+    std::string const& port,
+    unsigned int baudRate,
+    Protocol const& protocol = protocol::servo4,
+    PacketRecorder* recorder = nullptr,
+    unsigned int traceLink = packettrace::defaultLink);
+  ~ServoLink();
+
+  // opens and configures a serial port for writing without blocking
+  static int openPort(std::string const& port, unsigned int baudRate);
+
+  Protocol const& protocol() const;
+
+  // Session 0 is the panel's, driven from the UI thread, all other
+  // sessions are driven from a single other thread. Each session has at
+  // most one servo active and the link is shared fairly between them.
+  void start(unsigned int cmd, unsigned int value, unsigned int session = 0);
+  // origin is the input that led to the update, see latency.h
+  void update(
+    unsigned int newValue,
+    latency::Clock::time_point origin,
+    unsigned int session = 0);
+  void finish(unsigned int session = 0);
+  // sends and stores a value as bulk traffic, behind any edits
+  void set(unsigned int cmd, unsigned int value, unsigned int session = 0);
+
+  // True while commands from session, or the sessions sharing its ring,
+  // are waiting for the I/O thread because the link is behind. Anything
+  // more posted for those sessions would only wait, and once the ring
+  // fills it would block.
+  bool backedUp(unsigned int session) const;
+
+  // true once everything posted so far has been written to the port
+  bool idle() const;
+
+  Stats stats() const;
+
+private:
+  struct Command
+  {
+    enum Type
+    {
+      Start,
+      Update,
+      Stop,
+      Set,
+      Quit
+    };
+
+    Type type_;
+    unsigned int cmd_;
+    unsigned int value_;
+    latency::Clock::time_point origin_;
+    unsigned int session_;
+  };
+
+  // the servo a session has active
+  struct Channel
+  {
+    bool changed_;
+    unsigned int cmd_;
+    unsigned int value_;
+    latency::Clock::time_point origin_;
+    std::chrono::steady_clock::time_point lastSend_;
+  };
+
+  // a value waiting for a packet slot, optionally followed by a store
+  struct Pending
+  {
+    unsigned int session_;
+    unsigned int cmd_;
+    unsigned int value_;
+    bool store_;
+    latency::Clock::time_point origin_;
+    std::chrono::steady_clock::time_point queued_;
+  };
+
+  void post(Command const& command);
+  void run();
+  // true while commands from commands_[ring] can be queued
+  bool hasRoom(std::size_t ring) const;
+  void queue(unsigned int cmd, unsigned int value);
+  void flush();
+  void drain();
+  void rollWindow(std::chrono::steady_clock::time_point now);
+  void publishBacklog(std::map<unsigned int, Channel> const& channels);
+
+private:
+  int fd_;
+  int wakeFd_;
+  Protocol const& protocol_;
+  PacketRecorder* recorder_;
+  unsigned int traceLink_;
+  unsigned int budget_;
+  std::chrono::microseconds packetInterval_;
+  std::chrono::microseconds keepAliveInterval_;
+  std::chrono::microseconds agingLimit_;
+  SpscRing<Command, 64> commands_[2]; // from session 0 and the rest
+  // final values of finished edits, by session
+  std::map<unsigned int, std::deque<Pending>> finishing_;
+  std::deque<Pending> bulk_;
+  // finished edits and sets queued from each of commands_
+  std::size_t finishingCount_[2];
+  std::size_t bulkCount_[2];
+  std::vector<char> outBuf_;
+  std::size_t outPos_;
+  latency::Clock::time_point outOrigin_;
+  std::chrono::steady_clock::time_point windowStart_;
+  unsigned int windowBytes_;
+  std::atomic<unsigned int> bytesPerSec_;
+  std::atomic<unsigned long> packets_;
+  std::atomic<unsigned long> coalesced_;
+  std::atomic<unsigned long> writeErrors_;
+  std::atomic<unsigned long> posted_;
+  std::atomic<unsigned long> handled_;
+  std::atomic<std::size_t> unsent_;
+  std::atomic<std::size_t> backlog_;
+  std::atomic<std::size_t> changed_; // channels with a value to send
+  std::atomic<std::chrono::steady_clock::rep> oldestQueued_; // 0 if none
+  std::thread thread_;
+};
+
+#endif // !defined SERVOLINK_H
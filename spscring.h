@@ -0,0 +1,66 @@
+// Copyright Ian Wakeling 2021
+// License MIT
+
+#if !defined SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed size lock free queue for passing items from exactly one producer
+// thread to exactly one consumer thread. Size must be a power of two.
+template<typename T, std::size_t Size>
+class SpscRing
+{
+  static_assert((Size & (Size - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+  SpscRing()
+    : head_(0)
+    , tail_(0)
+  {
+  }
+
+  // producer only, returns false if the ring is full
+  bool push(T const& item)
+  {
+    auto head = head_.load(std::memory_order_relaxed);
+    if( head - tail_.load(std::memory_order_acquire) == Size )
+    {
+      return false;
+    }
+    items_[head & (Size - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only, returns false if the ring is empty
+  bool pop(T& item)
+  {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if( tail == head_.load(std::memory_order_acquire) )
+    {
+      return false;
+    }
+    item = items_[tail & (Size - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // approximate when called from neither producer nor consumer
+  std::size_t size() const
+  {
+    return head_.load(std::memory_order_acquire)
+      - tail_.load(std::memory_order_acquire);
+  }
+
+private:
+  // keep the indices on separate cache lines so the producer and consumer
+  // don't contend
+  std::atomic<std::size_t> head_;
+  char pad_[64 - sizeof(std::atomic<std::size_t>)];
+  std::atomic<std::size_t> tail_;
+  T items_[Size];
+};
+
+#endif // !defined SPSCRING_H
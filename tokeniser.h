@@ -4,27 +4,30 @@
 #if !defined TOKENISER_H
 #define TOKENISER_H
 
-#include <string>
+#include <string_view>
 
+// Splits a line at commas. Tokens are views into the input, which must
+// outlive the Tokeniser.
 class Tokeniser
 {
 public:
-  Tokeniser(std::string input)
-    : input_(std::move(input))
+  Tokeniser(std::string_view input)
+    : input_(input)
     , pos_(0)
+    , start_(0)
   {
   }
 
-  std::pair<bool,std::string> next()
+  std::pair<bool,std::string_view> next()
   {
-    std::pair<bool,std::string> result{false,""};
-    if( pos_ != std::string::npos )
+    std::pair<bool,std::string_view> result{false,{}};
+    if( pos_ != std::string_view::npos )
     {
-      auto start = pos_;
-      pos_ = input_.find(',', start);
+      start_ = pos_;
+      pos_ = input_.find(',', start_);
       result.first = true;
-      result.second = input_.substr(start, pos_ - start);
-      if( pos_ != std::string::npos )
+      result.second = input_.substr(start_, pos_ - start_);
+      if( pos_ != std::string_view::npos )
       {
         pos_++;
       }
@@ -32,14 +35,26 @@ public:
     return result;
   }
 
-  std::string remainder()
+  std::string_view remainder()
   {
+    if( pos_ == std::string_view::npos )
+    {
+      return {};
+    }
+    start_ = pos_;
     return input_.substr(pos_);
   }
 
+  // offset into the input of the last token returned
+  std::string_view::size_type offset() const
+  {
+    return start_;
+  }
+
 private:
-  std::string input_;
-  std::string::size_type pos_;
+  std::string_view input_;
+  std::string_view::size_type pos_;
+  std::string_view::size_type start_;
 };
 
 #endif // !defined TOKENISER_H